@@ -7,6 +7,7 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -73,6 +74,11 @@ struct channel {
 								   any interrupt would be spurious. */
 	struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+	struct lock queue_lock;     /* Protects QUEUE and HEAD. */
+	struct condition queue_nonempty;    /* Signaled on submission. */
+	struct list queue;          /* Pending disk_requests, by position. */
+	uint64_t head;              /* Position just past the last command. */
+
 	struct disk devices[2];     /* The devices on this channel. */
 };
 
@@ -84,7 +90,7 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
-static void select_sector (struct disk *, disk_sector_t);
+static void select_sector (struct disk *, disk_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -95,11 +101,13 @@ static void select_device (const struct disk *);
 static void select_device_wait (const struct disk *);
 
 static void interrupt_handler (struct intr_frame *);
+static void channel_thread (void *);
 
 /* Initialize the disk subsystem and detect disks. */
 void
 disk_init (void) {
 	size_t chan_no;
+	char name[16];
 
 	for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
 		struct channel *c = &channels[chan_no];
@@ -120,8 +128,15 @@ disk_init (void) {
 				NOT_REACHED ();
 		}
 		lock_init (&c->lock);
+		lock_set_name (&c->lock, c->name);
 		c->expecting_interrupt = false;
 		sema_init (&c->completion_wait, 0);
+		lock_init (&c->queue_lock);
+		snprintf (name, sizeof name, "%s queue", c->name);
+		lock_set_name (&c->queue_lock, name);
+		cond_init (&c->queue_nonempty);
+		list_init (&c->queue);
+		c->head = 0;
 
 		/* Initialize devices. */
 		for (dev_no = 0; dev_no < 2; dev_no++) {
@@ -150,6 +165,11 @@ disk_init (void) {
 		for (dev_no = 0; dev_no < 2; dev_no++)
 			if (c->devices[dev_no].is_ata)
 				identify_ata_device (&c->devices[dev_no]);
+
+		/* Start serving requests.  Disk I/O is short and everyone
+		   else waits for it, so run it before anything else. */
+		if (c->devices[0].is_ata || c->devices[1].is_ata)
+			thread_create (c->name, PRI_MAX, channel_thread, c);
 	}
 
 	/* DO NOT MODIFY BELOW LINES. */
@@ -209,21 +229,7 @@ disk_size (struct disk *d) {
    per-disk locking is unneeded. */
 void
 disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
-	struct channel *c;
-
-	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
-
-	c = d->channel;
-	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-	sema_down (&c->completion_wait);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-	input_sector (c, buffer);
-	d->read_cnt++;
-	lock_release (&c->lock);
+	disk_read_n (d, sec_no, buffer, 1);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -233,23 +239,233 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
    per-disk locking is unneeded. */
 void
 disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
-	struct channel *c;
+	disk_write_n (d, sec_no, buffer, 1);
+}
+
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D
+   into BUFFER, which must have room for CNT * DISK_SECTOR_SIZE
+   bytes.  All sectors are transferred by a single READ SECTOR
+   command, so the channel is selected and locked only once.
+   CNT must be between 1 and DISK_MULTI_MAX. */
+void
+disk_read_n (struct disk *d, disk_sector_t sec_no, void *buffer, size_t cnt) {
+	disk_readv (d, sec_no, &buffer, 1, cnt);
+}
+
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D from
+   BUFFER, which must contain CNT * DISK_SECTOR_SIZE bytes, with a
+   single WRITE SECTOR command.  Returns after the disk has
+   acknowledged receiving the data.
+   CNT must be between 1 and DISK_MULTI_MAX. */
+void
+disk_write_n (struct disk *d, disk_sector_t sec_no, const void *buffer,
+		size_t cnt) {
+	disk_writev (d, sec_no, &buffer, 1, cnt);
+}
+
+/* Scatter version of disk_read_n(): reads BUF_CNT * BUF_SECTORS
+   consecutive sectors starting at SEC_NO,
+   BUF_SECTORS of them into each of BUFS[0] ... BUFS[BUF_CNT - 1].
+   The total must be between 1 and DISK_MULTI_MAX sectors. */
+void
+disk_readv (struct disk *d, disk_sector_t sec_no, void *const bufs[],
+		size_t buf_cnt, size_t buf_sectors) {
+	struct disk_request r;
+
+	disk_request_init (&r, d, sec_no, false, bufs, buf_cnt, buf_sectors);
+	disk_submit (&r);
+	disk_wait (&r);
+}
+
+/* Gather version of disk_write_n(): writes BUF_SECTORS sectors from
+   each of BUFS[0] ... BUFS[BUF_CNT - 1] to consecutive sectors
+   starting at SEC_NO.
+   The total must be between 1 and DISK_MULTI_MAX sectors. */
+void
+disk_writev (struct disk *d, disk_sector_t sec_no, const void *const bufs[],
+		size_t buf_cnt, size_t buf_sectors) {
+	struct disk_request r;
+
+	disk_request_init (&r, d, sec_no, true, (void *const *) bufs,
+			buf_cnt, buf_sectors);
+	disk_submit (&r);
+	disk_wait (&r);
+}
+
+/* Asynchronous requests.
 
+   Each channel keeps its pending requests in a queue sorted by
+   position, device first and then sector.  A per-channel kernel
+   thread serves them in C-LOOK order: it takes the first request
+   at or past the end of the previous one, wrapping around to the
+   lowest position when there is none, and merges requests that
+   continue exactly where it ends into the same command. */
+
+/* Initializes R to transfer BUF_CNT * BUF_SECTORS sectors of disk
+   D starting at SEC_NO, BUF_SECTORS of them from or to each of
+   BUFS[0] ... BUFS[BUF_CNT - 1].  WRITE selects the direction.
+   The total must be between 1 and DISK_MULTI_MAX sectors. */
+void
+disk_request_init (struct disk_request *r, struct disk *d,
+		disk_sector_t sec_no, bool write, void *const bufs[],
+		size_t buf_cnt, size_t buf_sectors) {
+	ASSERT (r != NULL);
 	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
+	ASSERT (bufs != NULL);
+	ASSERT (buf_cnt * buf_sectors > 0
+			&& buf_cnt * buf_sectors <= DISK_MULTI_MAX);
+
+	r->disk = d;
+	r->sec_no = sec_no;
+	r->write = write;
+	r->bufs = bufs;
+	r->buf_cnt = buf_cnt;
+	r->buf_sectors = buf_sectors;
+	sema_init (&r->done, 0);
+}
+
+/* Number of sectors R transfers. */
+static size_t
+request_sectors (const struct disk_request *r) {
+	return r->buf_cnt * r->buf_sectors;
+}
+
+/* Position of R in its channel's queue. */
+static uint64_t
+request_pos (const struct disk_request *r) {
+	return ((uint64_t) r->disk->dev_no << 32) | r->sec_no;
+}
+
+/* Orders requests by position.  Requests at the same position
+   keep their submission order. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+		void *aux UNUSED) {
+	const struct disk_request *a = list_entry (a_, struct disk_request, elem);
+	const struct disk_request *b = list_entry (b_, struct disk_request, elem);
+	return request_pos (a) < request_pos (b);
+}
+
+/* Queues R and returns without waiting for it.  R, and the buffer
+   array and buffers it points to, must stay valid until
+   disk_wait() returns for it.  Requests overlapping one another
+   may be served in any order. */
+void
+disk_submit (struct disk_request *r) {
+	struct channel *c = r->disk->channel;
+
+	ASSERT (r->sec_no + request_sectors (r) <= r->disk->capacity);
+
+	lock_acquire (&c->queue_lock);
+	list_insert_ordered (&c->queue, &r->elem, request_less, NULL);
+	cond_signal (&c->queue_nonempty, &c->queue_lock);
+	lock_release (&c->queue_lock);
+}
+
+/* Blocks until R, which must have been submitted, is complete. */
+void
+disk_wait (struct disk_request *r) {
+	sema_down (&r->done);
+}
+
+/* Runs one command that transfers the CNT sectors of the requests in
+   BATCH, which are consecutive and go the same way, on disk D
+   starting at SEC_NO. */
+static void
+transfer_batch (struct disk *d, disk_sector_t sec_no, bool write,
+		struct list *batch, size_t cnt) {
+	struct channel *c = d->channel;
+	disk_sector_t sec = sec_no;
+	struct list_elem *e;
+	size_t i;
 
-	c = d->channel;
 	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-	output_sector (c, buffer);
-	sema_down (&c->completion_wait);
-	d->write_cnt++;
+	select_sector (d, sec_no, cnt);
+	issue_pio_command (c, write ? CMD_WRITE_SECTOR_RETRY
+			: CMD_READ_SECTOR_RETRY);
+	for (e = list_begin (batch); e != list_end (batch); e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+
+		for (i = 0; i < request_sectors (r); i++, sec++) {
+			uint8_t *buf = (uint8_t *) r->bufs[i / r->buf_sectors]
+				+ i % r->buf_sectors * DISK_SECTOR_SIZE;
+			if (write) {
+				/* The device asks for each sector with DRQ and
+				   interrupts once it has taken it. */
+				if (!wait_while_busy (d))
+					PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec);
+				output_sector (c, buf);
+				sema_down (&c->completion_wait);
+			} else {
+				/* The device interrupts once per sector it has ready. */
+				sema_down (&c->completion_wait);
+				if (!wait_while_busy (d))
+					PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec);
+				input_sector (c, buf);
+			}
+		}
+	}
+	if (write)
+		d->write_cnt += cnt;
+	else
+		d->read_cnt += cnt;
 	lock_release (&c->lock);
 }
-
+
+/* Serves the request queue of channel C_, forever. */
+static void
+channel_thread (void *c_) {
+	struct channel *c = c_;
+
+	for (;;) {
+		struct disk_request *first, *r;
+		struct list_elem *e;
+		struct list batch;
+		size_t cnt;
+
+		lock_acquire (&c->queue_lock);
+		while (list_empty (&c->queue))
+			cond_wait (&c->queue_nonempty, &c->queue_lock);
+
+		/* C-LOOK: keep going up, then jump back to the lowest. */
+		for (e = list_begin (&c->queue); e != list_end (&c->queue);
+				e = list_next (e))
+			if (request_pos (list_entry (e, struct disk_request, elem))
+					>= c->head)
+				break;
+		if (e == list_end (&c->queue))
+			e = list_begin (&c->queue);
+
+		list_init (&batch);
+		first = list_entry (e, struct disk_request, elem);
+		cnt = request_sectors (first);
+		e = list_remove (&first->elem);
+		list_push_back (&batch, &first->elem);
+
+		/* Merge the requests that continue where the batch ends. */
+		while (e != list_end (&c->queue)) {
+			r = list_entry (e, struct disk_request, elem);
+			if (r->disk != first->disk || r->write != first->write
+					|| r->sec_no != first->sec_no + cnt
+					|| cnt + request_sectors (r) > DISK_MULTI_MAX)
+				break;
+			cnt += request_sectors (r);
+			e = list_remove (&r->elem);
+			list_push_back (&batch, &r->elem);
+		}
+		c->head = request_pos (first) + cnt;
+		lock_release (&c->queue_lock);
+
+		transfer_batch (first->disk, first->sec_no, first->write, &batch, cnt);
+
+		/* A request may be gone as soon as its waiter wakes up. */
+		while (!list_empty (&batch)) {
+			r = list_entry (list_pop_front (&batch), struct disk_request, elem);
+			sema_up (&r->done);
+		}
+	}
+}
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
@@ -402,17 +618,17 @@ print_ata_string (char *string, size_t size) {
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT to the disk's sector
+   selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) {
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt) {
 	struct channel *c = d->channel;
 
-	ASSERT (sec_no < d->capacity);
-	ASSERT (sec_no < (1UL << 28));
+	ASSERT (sec_no + cnt <= d->capacity);
+	ASSERT (sec_no + cnt <= (1UL << 28));
 
 	select_device_wait (d);
-	outb (reg_nsect (c), 1);
+	outb (reg_nsect (c), cnt == DISK_MULTI_MAX ? 0 : cnt);
 	outb (reg_lbal (c), sec_no);
 	outb (reg_lbam (c), sec_no >> 8);
 	outb (reg_lbah (c), (sec_no >> 16));
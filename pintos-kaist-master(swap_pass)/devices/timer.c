@@ -17,32 +17,121 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
+/* 8254 input frequency and the count that divides it down to
+   TIMER_FREQ, rounded to nearest. */
+#define PIT_HZ 1193180
+#define PIT_TICK_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Most ticks a single one-shot countdown can cover. */
+#define PIT_MAX_TICKS (0xffff / PIT_TICK_COUNT)
+
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* If true, stop the periodic tick while the CPU is idle.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* Ticks covered by the one-shot countdown running while idle, or 0
+   if the timer is periodic. */
+static int64_t idle_shot_ticks;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Armed timers; the top is the next one to expire. */
+static struct heap timer_heap;
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
+static void timer_expire (void);
+static heap_less_func timer_event_less;
+static void timer_account_tick (void);
+static void pit_periodic (void);
 
 /* Sets up the 8254 Programmable Interval Timer (PIT) to
    interrupt PIT_FREQ times per second, and registers the
    corresponding interrupt. */
 void
 timer_init (void) {
-	/* 8254 input frequency divided by TIMER_FREQ, rounded to
-	   nearest. */
-	uint16_t count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
+	heap_init (&timer_heap, timer_event_less, NULL);
+	pit_periodic ();
+	intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+}
+
+/* Programs the PIT to interrupt TIMER_FREQ times per second. */
+static void
+pit_periodic (void) {
+	uint16_t count = PIT_TICK_COUNT;
 
 	outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
 	outb (0x40, count & 0xff);
 	outb (0x40, count >> 8);
+}
 
-	intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+/* Called by the idle thread, with interrupts off, just before it
+   halts.  In tickless mode, replaces the periodic tick by a single
+   interrupt at the next timer deadline, or as late as the PIT can
+   count if that is further away. */
+void
+timer_idle_enter (void) {
+	int64_t delta;
+	uint16_t count;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (!timer_tickless || idle_shot_ticks != 0)
+		return;
+
+	delta = timer_next_deadline () - ticks;
+	if (delta <= 1)
+		return;
+	if (delta > PIT_MAX_TICKS)
+		delta = PIT_MAX_TICKS;
+
+	count = delta * PIT_TICK_COUNT;
+	outb (0x43, 0x30);    /* CW: counter 0, LSB then MSB, mode 0, binary. */
+	outb (0x40, count & 0xff);
+	outb (0x40, count >> 8);
+	idle_shot_ticks = delta;
+}
+
+/* Called with interrupts off when the CPU leaves the idle halt,
+   first thing in every external interrupt.  Accounts for the ticks
+   that passed during the one-shot countdown armed by
+   timer_idle_enter(), if any, as read back from the PIT, and
+   restores the periodic tick.  If the countdown ran out, its
+   interrupt delivers the last tick, so at most IDLE_SHOT_TICKS - 1
+   are accounted here. */
+void
+timer_idle_exit (void) {
+	int64_t elapsed;
+	uint16_t left;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (idle_shot_ticks == 0)
+		return;
+
+	outb (0x43, 0x00);    /* Latch counter 0. */
+	left = inb (0x40);
+	left |= inb (0x40) << 8;
+	if (left > idle_shot_ticks * PIT_TICK_COUNT)
+		elapsed = idle_shot_ticks - 1;   /* Ran out and wrapped. */
+	else
+		elapsed = (idle_shot_ticks * PIT_TICK_COUNT - left) / PIT_TICK_COUNT;
+	if (elapsed >= idle_shot_ticks)
+		elapsed = idle_shot_ticks - 1;
+	idle_shot_ticks = 0;
+	pit_periodic ();
+
+	while (elapsed-- > 0) {
+		ticks++;
+		thread_account_idle ();
+		timer_account_tick ();
+	}
+	timer_expire ();
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -98,6 +187,87 @@ timer_sleep (int64_t ticks) {
 	if(timer_elapsed(start) < ticks)
 		thread_sleep(start + ticks);
 }
+
+/* Initializes timer T to call FUNC(AUX) when it expires. */
+void
+timer_event_init (struct timer_event *t, timer_event_func *func, void *aux) {
+	ASSERT (t != NULL);
+	ASSERT (func != NULL);
+
+	t->func = func;
+	t->aux = aux;
+	t->armed = false;
+}
+
+/* Orders armed timers by expiry tick. */
+static bool
+timer_event_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct timer_event *a = heap_entry (a_, struct timer_event, elem);
+	const struct timer_event *b = heap_entry (b_, struct timer_event, elem);
+
+	return a->expires < b->expires;
+}
+
+/* Arms timer T to expire at tick EXPIRES, rearming it if it is
+   already armed.  An EXPIRES already in the past fires T at the
+   next tick.  May be called from interrupt context, including from
+   a timer callback. */
+void
+timer_event_arm (struct timer_event *t, int64_t expires) {
+	enum intr_level old_level = intr_disable ();
+
+	timer_event_cancel (t);
+	t->expires = expires;
+	t->armed = true;
+	heap_push (&timer_heap, &t->elem);
+	intr_set_level (old_level);
+}
+
+/* Disarms timer T.  Returns true if T was armed, false if it had
+   already expired or was never armed. */
+bool
+timer_event_cancel (struct timer_event *t) {
+	enum intr_level old_level = intr_disable ();
+	bool was_armed = t->armed;
+
+	if (was_armed) {
+		heap_remove (&timer_heap, &t->elem);
+		t->armed = false;
+	}
+	intr_set_level (old_level);
+	return was_armed;
+}
+
+/* Returns the tick at which the next armed timer expires, or
+   INT64_MAX if no timer is armed. */
+int64_t
+timer_next_deadline (void) {
+	enum intr_level old_level = intr_disable ();
+	int64_t deadline = INT64_MAX;
+
+	if (!heap_empty (&timer_heap))
+		deadline = heap_entry (heap_top (&timer_heap),
+				struct timer_event, elem)->expires;
+	intr_set_level (old_level);
+	return deadline;
+}
+
+/* Fires every timer that is due.  A tick with nothing due costs
+   a single comparison against the heap root. */
+static void
+timer_expire (void) {
+	while (!heap_empty (&timer_heap)) {
+		struct timer_event *t = heap_entry (heap_top (&timer_heap),
+				struct timer_event, elem);
+
+		if (t->expires > ticks)
+			break;
+		heap_pop (&timer_heap);
+		t->armed = false;
+		t->func (t->aux);
+	}
+}
 /* Suspends execution for approximately MS milliseconds. */
 void
 timer_msleep (int64_t ms) {
@@ -122,22 +292,31 @@ timer_print_stats (void) {
 	printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
-/* Timer interrupt handler. */
+/* Timer interrupt handler.  If the idle countdown ran out,
+   intr_handler() has already caught up on the ticks it covered, so
+   this one counts as usual. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED) {
 	ticks++;
 	thread_tick ();
+	timer_account_tick ();
+	timer_expire ();
+}
+
+/* Per-tick scheduler bookkeeping that must not be skipped when
+   idle ticks are accounted late. */
+static void
+timer_account_tick (void) {
 	if(thread_mlfqs){
 		up_recent();
 		if(ticks % 4 == 0){
-			all_recal();
+			recal_quantum();
 			if(ticks % TIMER_FREQ == 0){
 				recal_load();
-				all_recal_r();
+				recal_decay();
 			}
 		}
 	}
-thread_wakeup(ticks);
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
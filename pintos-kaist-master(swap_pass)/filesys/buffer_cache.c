@@ -0,0 +1,187 @@
+#include "filesys/buffer_cache.h"
+#include <debug.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* A cached sector of the file system disk. */
+struct cache_entry {
+	disk_sector_t sector;               /* Cached sector. */
+	bool valid;                         /* True if DATA holds SECTOR. */
+	bool dirty;                         /* True if DATA is newer than disk. */
+	bool accessed;                      /* Used since the hand passed. */
+	bool loading;                       /* Being filled by its pinner. */
+	int pin_cnt;                        /* Never evicted while nonzero. */
+	uint8_t data[DISK_SECTOR_SIZE];     /* Sector contents. */
+};
+
+static struct cache_entry cache[BUFFER_CACHE_SIZE];
+static struct lock cache_lock;          /* Protects CACHE and HAND. */
+/* Broadcast when a pin drops or an entry is done loading. */
+static struct condition cache_changed;
+static size_t hand;                     /* Clock hand into CACHE. */
+
+/* Interval of the background write-behind, in timer ticks. */
+#define FLUSH_INTERVAL TIMER_FREQ
+
+static void flusher (void *aux);
+
+/* Initializes the buffer cache and starts writing dirty sectors
+ * behind in the background. */
+void
+buffer_cache_init (void) {
+	lock_init (&cache_lock);
+	lock_set_name (&cache_lock, "cache_lock");
+	cond_init (&cache_changed);
+	thread_create ("bc-flush", PRI_DEFAULT, flusher, NULL);
+}
+
+/* Writes E back to disk if it is dirty.
+ * Must be called with cache_lock held. */
+static void
+entry_clean (struct cache_entry *e) {
+	if (e->valid && e->dirty) {
+		disk_write (filesys_disk, e->sector, e->data);
+		e->dirty = false;
+	}
+}
+
+/* Returns the entry caching SECTOR, or a null pointer.
+ * Must be called with cache_lock held. */
+static struct cache_entry *
+cache_lookup (disk_sector_t sector) {
+	for (size_t i = 0; i < BUFFER_CACHE_SIZE; i++)
+		if (cache[i].valid && cache[i].sector == sector)
+			return &cache[i];
+	return NULL;
+}
+
+/* Second chance clock: returns an entry to reuse after writing it
+ * back if needed.  Pinned entries are passed over.  If all of them
+ * are pinned, waits for a pin to drop and returns a null pointer,
+ * since the cache may have changed meanwhile.
+ * Must be called with cache_lock held. */
+static struct cache_entry *
+cache_evict (void) {
+	for (size_t scanned = 0; ; scanned++) {
+		if (scanned == 2 * BUFFER_CACHE_SIZE) {
+			cond_wait (&cache_changed, &cache_lock);
+			return NULL;
+		}
+		struct cache_entry *e = &cache[hand];
+		hand = (hand + 1) % BUFFER_CACHE_SIZE;
+		if (!e->valid)
+			return e;
+		if (e->pin_cnt > 0)
+			continue;
+		if (e->accessed)
+			e->accessed = false;
+		else {
+			entry_clean (e);
+			e->valid = false;
+			return e;
+		}
+	}
+}
+
+/* Returns the entry for SECTOR, bringing it in first unless
+ * OVERWRITE, which means the caller replaces the whole sector.  An
+ * entry left unread for that reason is loading until the caller
+ * unpins it, and others wait for it.
+ * Must be called with cache_lock held. */
+static struct cache_entry *
+cache_get (disk_sector_t sector, bool overwrite) {
+	struct cache_entry *e;
+
+	for (;;) {
+		e = cache_lookup (sector);
+		if (e != NULL) {
+			if (!e->loading)
+				break;
+			cond_wait (&cache_changed, &cache_lock);
+		} else if ((e = cache_evict ()) != NULL) {
+			if (!overwrite)
+				disk_read (filesys_disk, sector, e->data);
+			e->sector = sector;
+			e->valid = true;
+			e->dirty = false;
+			e->loading = overwrite;
+			break;
+		}
+	}
+	e->accessed = true;
+	return e;
+}
+
+/* Returns the entry for SECTOR like cache_get, pinned so that it
+ * can be used without cache_lock. */
+static struct cache_entry *
+cache_pin (disk_sector_t sector, bool overwrite) {
+	lock_acquire (&cache_lock);
+	struct cache_entry *e = cache_get (sector, overwrite);
+	e->pin_cnt++;
+	lock_release (&cache_lock);
+	return e;
+}
+
+/* Undoes cache_pin of E, marking it dirty if DIRTY, and ends its
+ * loading.  Done after the copy, so that a flush that raced the copy
+ * does not leave it clean. */
+static void
+cache_unpin (struct cache_entry *e, bool dirty) {
+	lock_acquire (&cache_lock);
+	ASSERT (e->pin_cnt > 0);
+	if (dirty)
+		e->dirty = true;
+	if (--e->pin_cnt == 0 || e->loading) {
+		e->loading = false;
+		cond_broadcast (&cache_changed, &cache_lock);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Copies SIZE bytes at offset OFS of SECTOR into BUFFER.  BUFFER may
+ * be user memory: a page fault on it may read the file system again,
+ * so the copy runs without cache_lock. */
+void
+buffer_cache_read (disk_sector_t sector, void *buffer, int ofs, int size) {
+	ASSERT (ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+	struct cache_entry *e = cache_pin (sector, false);
+	memcpy (buffer, e->data + ofs, size);
+	cache_unpin (e, false);
+}
+
+/* Copies SIZE bytes from BUFFER, which may be user memory, to offset
+ * OFS of SECTOR.  The sector reaches the disk when it is evicted or
+ * flushed. */
+void
+buffer_cache_write (disk_sector_t sector, const void *buffer, int ofs,
+		int size) {
+	ASSERT (ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+	struct cache_entry *e = cache_pin (sector, size == DISK_SECTOR_SIZE);
+	memcpy (e->data + ofs, buffer, size);
+	cache_unpin (e, true);
+}
+
+/* Writes every dirty sector back to disk. */
+void
+buffer_cache_flush (void) {
+	lock_acquire (&cache_lock);
+	for (size_t i = 0; i < BUFFER_CACHE_SIZE; i++)
+		entry_clean (&cache[i]);
+	lock_release (&cache_lock);
+}
+
+/* Write-behind: flushes the cache periodically, so that a crash
+ * loses at most FLUSH_INTERVAL ticks of writes. */
+static void
+flusher (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (FLUSH_INTERVAL);
+		buffer_cache_flush ();
+	}
+}
@@ -1,30 +1,59 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "threads/kmem.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "filesys/page_cache.h"
+
+/* File data goes through the page cache, shared with mmap. */
+#define file_data_read page_cache_read
+#define file_data_write page_cache_write
+#else
+#define file_data_read inode_read_at
+#define file_data_write inode_write_at
+#endif
+
+/* Largest readahead window, in pages. */
+#define FILE_RA_MAX 32
 
 /* An open file. */
 struct file {
 	struct inode *inode;        /* File's inode. */
 	off_t pos;                  /* Current position. */
 	bool deny_write;            /* Has file_deny_write() been called? */
+	off_t ra_next;              /* Offset a sequential read continues at. */
+	off_t ra_end;               /* End of the readahead issued so far. */
+	int ra_window;              /* Readahead window, in pages. */
 	// int oc;                     /*open count */
 };
 
+/* Cache of struct file. */
+static struct kmem_cache file_cache;
+
+/* Initializes the file module. */
+void
+file_init (void) {
+	kmem_cache_init (&file_cache, "file", sizeof (struct file), NULL);
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
  * and returns the new file.  Returns a null pointer if an
  * allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) {
-	struct file *file = calloc (1, sizeof *file);
+	struct file *file = kmem_cache_zalloc (&file_cache);
 	if (inode != NULL && file != NULL) {
 		file->inode = inode;
 		file->pos = 0;
 		file->deny_write = false;
+		file->ra_next = 0;
+		file->ra_end = 0;
+		file->ra_window = 0;
 		return file;
 	} else {
 		inode_close (inode);
-		free (file);
+		kmem_cache_free (&file_cache, file);
 		return NULL;
 	}
 }
@@ -55,7 +84,7 @@ file_close (struct file *file) {
 	if (file != NULL) {
 		file_allow_write (file);
 		inode_close (file->inode);
-		free (file);
+		kmem_cache_free (&file_cache, file);
 	}
 }
 
@@ -65,6 +94,39 @@ file_get_inode (struct file *file) {
 	return file->inode;
 }
 
+/* Tracks the access pattern of FILE after BYTES_READ bytes were read
+ * at OFFSET.  Sequential reads double the readahead window, up to
+ * FILE_RA_MAX pages, and others halve it and forget what was read
+ * ahead so far; the window past the end of the read is then read
+ * ahead into the page cache in the background.  Without the page
+ * cache only the access pattern is tracked. */
+static void
+file_readahead (struct file *file, off_t offset, off_t bytes_read) {
+	off_t start, end;
+
+	if (offset == file->ra_next)
+		file->ra_window = file->ra_window == 0 ? 1
+			: file->ra_window * 2 > FILE_RA_MAX ? FILE_RA_MAX
+			: file->ra_window * 2;
+	else {
+		file->ra_window /= 2;
+		file->ra_end = offset + bytes_read;
+	}
+	file->ra_next = offset + bytes_read;
+	if (file->ra_window == 0)
+		return;
+
+	/* Skip what was already issued by the previous reads. */
+	end = file->ra_next + file->ra_window * PGSIZE;
+	start = file->ra_end > file->ra_next ? file->ra_end : file->ra_next;
+	if (start < end) {
+#ifdef VM
+		page_cache_prefetch (file->inode, start, end - start);
+#endif
+		file->ra_end = end;
+	}
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
  * starting at the file's current position.
  * Returns the number of bytes actually read,
@@ -72,7 +134,8 @@ file_get_inode (struct file *file) {
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_read (struct file *file, void *buffer, off_t size) {
-	off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+	off_t bytes_read = file_data_read (file->inode, buffer, size, file->pos);
+	file_readahead (file, file->pos, bytes_read);
 	file->pos += bytes_read;
 	return bytes_read;
 }
@@ -84,19 +147,20 @@ file_read (struct file *file, void *buffer, off_t size) {
  * The file's current position is unaffected. */
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
-	return inode_read_at (file->inode, buffer, size, file_ofs);
+	off_t bytes_read = file_data_read (file->inode, buffer, size, file_ofs);
+	file_readahead (file, file_ofs, bytes_read);
+	return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
  * starting at the file's current position.
  * Returns the number of bytes actually written,
- * which may be less than SIZE if end of file is reached.
- * (Normally we'd grow the file in that case, but file growth is
- * not yet implemented.)
+ * which may be less than SIZE if the disk is full.
+ * Writing past end of file grows the file.
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) {
-	off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+	off_t bytes_written = file_data_write (file->inode, buffer, size, file->pos);
 	file->pos += bytes_written;
 	return bytes_written;
 }
@@ -104,14 +168,13 @@ file_write (struct file *file, const void *buffer, off_t size) {
 /* Writes SIZE bytes from BUFFER into FILE,
  * starting at offset FILE_OFS in the file.
  * Returns the number of bytes actually written,
- * which may be less than SIZE if end of file is reached.
- * (Normally we'd grow the file in that case, but file growth is
- * not yet implemented.)
+ * which may be less than SIZE if the disk is full.
+ * Writing past end of file grows the file.
  * The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
 		off_t file_ofs) {
-	return inode_write_at (file->inode, buffer, size, file_ofs);
+	return file_data_write (file->inode, buffer, size, file_ofs);
 }
 
 /* Prevents write operations on FILE's underlying inode
@@ -6,7 +6,11 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/buffer_cache.h"
 #include "devices/disk.h"
+#ifdef VM
+#include "filesys/page_cache.h"
+#endif
 
 /* The disk that contains the file system. */
 struct disk *filesys_disk;
@@ -21,7 +25,10 @@ filesys_init (bool format) {
 	if (filesys_disk == NULL)
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
+	buffer_cache_init ();
 	inode_init ();
+	file_init ();
+	dir_init ();
 
 #ifdef EFILESYS
 	fat_init ();
@@ -51,6 +58,10 @@ filesys_done (void) {
 #else
 	free_map_close ();
 #endif
+#ifdef VM
+	page_cache_flush ();
+#endif
+	buffer_cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -5,18 +5,38 @@
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/buffer_cache.h"
+#ifdef VM
+#include "filesys/page_cache.h"
+#endif
+#include "threads/kmem.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of sector numbers held by the inode itself and by one
+ * index sector. */
+#define DIRECT_CNT 124
+#define INDIRECT_CNT (DISK_SECTOR_SIZE / sizeof (disk_sector_t))
+
+/* Most sectors a file can have. */
+#define MAX_SECTORS (DIRECT_CNT + INDIRECT_CNT + INDIRECT_CNT * INDIRECT_CNT)
+
 /* On-disk inode.
+ * Data sector I of the file is DIRECT[I] for the first DIRECT_CNT
+ * sectors, then entry I - DIRECT_CNT of the INDIRECT index sector,
+ * then found through the DOUBLY_INDIRECT sector of index sectors.
+ * A zero sector number means not allocated (sector 0 holds the free
+ * map inode).
  * Must be exactly DISK_SECTOR_SIZE bytes long. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
+	disk_sector_t direct[DIRECT_CNT];   /* Direct data sectors. */
+	disk_sector_t indirect;             /* Index of the next sectors. */
+	disk_sector_t doubly_indirect;      /* Index of index sectors. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -33,9 +53,171 @@ struct inode {
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+	struct lock grow_lock;              /* Serializes growth of the file. */
 	struct inode_disk data;             /* Inode content. */
 };
 
+/* Returns entry IDX of index sector SECTOR. */
+static disk_sector_t
+index_get (disk_sector_t sector, size_t idx) {
+	disk_sector_t entry;
+	buffer_cache_read (sector, &entry, idx * sizeof entry, sizeof entry);
+	return entry;
+}
+
+/* Sets entry IDX of index sector SECTOR to ENTRY. */
+static void
+index_set (disk_sector_t sector, size_t idx, disk_sector_t entry) {
+	buffer_cache_write (sector, &entry, idx * sizeof entry, sizeof entry);
+}
+
+/* Returns data sector IDX of DISK_INODE, or 0 if not allocated.
+ * The first DIRECT_CNT sectors need no disk access. */
+static disk_sector_t
+index_lookup (const struct inode_disk *disk_inode, size_t idx) {
+	if (idx < DIRECT_CNT)
+		return disk_inode->direct[idx];
+	idx -= DIRECT_CNT;
+	if (idx < INDIRECT_CNT)
+		return disk_inode->indirect
+			? index_get (disk_inode->indirect, idx) : 0;
+	idx -= INDIRECT_CNT;
+	if (disk_inode->doubly_indirect == 0)
+		return 0;
+	disk_sector_t l1 = index_get (disk_inode->doubly_indirect,
+			idx / INDIRECT_CNT);
+	return l1 ? index_get (l1, idx % INDIRECT_CNT) : 0;
+}
+
+/* Allocates a sector near HINT, zeroes it and stores it in *SECTORP.
+ * Returns false if the disk is full. */
+static bool
+sector_alloc (disk_sector_t hint, disk_sector_t *sectorp) {
+	static char zeros[DISK_SECTOR_SIZE];
+
+	if (!free_map_allocate_near (1, hint, sectorp))
+		return false;
+	buffer_cache_write (*sectorp, zeros, 0, DISK_SECTOR_SIZE);
+	return true;
+}
+
+/* Makes SECTOR data sector IDX of DISK_INODE, allocating index
+ * sectors near SECTOR as needed.  Returns false if the disk is full. */
+static bool
+index_install (struct inode_disk *disk_inode, size_t idx,
+		disk_sector_t sector) {
+	if (idx < DIRECT_CNT) {
+		disk_inode->direct[idx] = sector;
+		return true;
+	}
+	idx -= DIRECT_CNT;
+	if (idx < INDIRECT_CNT) {
+		if (disk_inode->indirect == 0
+				&& !sector_alloc (sector, &disk_inode->indirect))
+			return false;
+		index_set (disk_inode->indirect, idx, sector);
+		return true;
+	}
+	idx -= INDIRECT_CNT;
+	if (disk_inode->doubly_indirect == 0
+			&& !sector_alloc (sector, &disk_inode->doubly_indirect))
+		return false;
+	disk_sector_t l1 = index_get (disk_inode->doubly_indirect,
+			idx / INDIRECT_CNT);
+	if (l1 == 0) {
+		if (!sector_alloc (sector, &l1)) {
+			/* Sectors are installed in order, so the doubly indirect
+			 * sector has no children yet, which index_truncate
+			 * would miss. */
+			if (idx < INDIRECT_CNT) {
+				free_map_release (disk_inode->doubly_indirect, 1);
+				disk_inode->doubly_indirect = 0;
+			}
+			return false;
+		}
+		index_set (disk_inode->doubly_indirect, idx / INDIRECT_CNT, l1);
+	}
+	index_set (l1, idx % INDIRECT_CNT, sector);
+	return true;
+}
+
+/* Releases data sectors FROM and on of DISK_INODE, which has CNT, and
+ * the index sectors no longer needed. */
+static void
+index_truncate (struct inode_disk *disk_inode, size_t from, size_t cnt) {
+	size_t idx;
+
+	for (idx = from; idx < cnt; idx++) {
+		disk_sector_t sector = index_lookup (disk_inode, idx);
+		if (sector != 0)
+			free_map_release (sector, 1);
+		if (idx < DIRECT_CNT)
+			disk_inode->direct[idx] = 0;
+	}
+
+	/* Index sectors whose every entry is at FROM or later. */
+	if (cnt > DIRECT_CNT + INDIRECT_CNT && disk_inode->doubly_indirect) {
+		size_t first = from > DIRECT_CNT + INDIRECT_CNT
+			? DIV_ROUND_UP (from - DIRECT_CNT - INDIRECT_CNT, INDIRECT_CNT) : 0;
+		size_t last = DIV_ROUND_UP (cnt - DIRECT_CNT - INDIRECT_CNT,
+				INDIRECT_CNT);
+		for (idx = first; idx < last; idx++) {
+			disk_sector_t l1 = index_get (disk_inode->doubly_indirect, idx);
+			if (l1 != 0) {
+				free_map_release (l1, 1);
+				index_set (disk_inode->doubly_indirect, idx, 0);
+			}
+		}
+		if (first == 0) {
+			free_map_release (disk_inode->doubly_indirect, 1);
+			disk_inode->doubly_indirect = 0;
+		}
+	}
+	if (from <= DIRECT_CNT && disk_inode->indirect) {
+		free_map_release (disk_inode->indirect, 1);
+		disk_inode->indirect = 0;
+	}
+}
+
+/* Grows DISK_INODE to LENGTH bytes.  The new sectors are zeroed and
+ * allocated in runs as long as possible, right after the current last
+ * sector when it is free.  Returns false, leaving DISK_INODE as it was,
+ * if the disk is full or LENGTH is too large. */
+static bool
+inode_grow (struct inode_disk *disk_inode, off_t length) {
+	static char zeros[DISK_SECTOR_SIZE];
+	size_t have = bytes_to_sectors (disk_inode->length);
+	size_t want = bytes_to_sectors (length);
+	size_t old = have;
+
+	if (want > MAX_SECTORS)
+		return false;
+	while (have < want) {
+		disk_sector_t hint = have > 0 ? index_lookup (disk_inode, have - 1) + 1 : 0;
+		disk_sector_t first;
+		size_t run = want - have;
+		size_t i;
+
+		while (!free_map_allocate_near (run, hint, &first))
+			if ((run /= 2) == 0) {
+				index_truncate (disk_inode, old, have);
+				return false;
+			}
+		for (i = 0; i < run; i++) {
+			buffer_cache_write (first + i, zeros, 0, DISK_SECTOR_SIZE);
+			if (!index_install (disk_inode, have, first + i)) {
+				free_map_release (first + i, run - i);
+				index_truncate (disk_inode, old, have);
+				return false;
+			}
+			have++;
+		}
+	}
+	if (length > disk_inode->length)
+		disk_inode->length = length;
+	return true;
+}
+
 /* Returns the disk sector that contains byte offset POS within
  * INODE.
  * Returns -1 if INODE does not contain data for a byte at offset
@@ -44,7 +226,7 @@ static disk_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) {
 	ASSERT (inode != NULL);
 	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
+		return index_lookup (&inode->data, pos / DISK_SECTOR_SIZE);
 	else
 		return -1;
 }
@@ -53,10 +235,14 @@ byte_to_sector (const struct inode *inode, off_t pos) {
  * returns the same `struct inode'. */
 static struct list open_inodes;
 
+/* Cache of struct inode. */
+static struct kmem_cache inode_cache;
+
 /* Initializes the inode module. */
 void
 inode_init (void) {
 	list_init (&open_inodes);
+	kmem_cache_init (&inode_cache, "inode", sizeof (struct inode), NULL);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -77,18 +263,9 @@ inode_create (disk_sector_t sector, off_t length) {
 
 	disk_inode = calloc (1, sizeof *disk_inode);
 	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
-		disk_inode->length = length;
 		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
+		if (inode_grow (disk_inode, length)) {
+			buffer_cache_write (sector, disk_inode, 0, DISK_SECTOR_SIZE);
 			success = true; 
 		} 
 		free (disk_inode);
@@ -115,7 +292,7 @@ inode_open (disk_sector_t sector) {
 	}
 
 	/* Allocate memory. */
-	inode = malloc (sizeof *inode);
+	inode = kmem_cache_alloc (&inode_cache);
 	if (inode == NULL)
 		return NULL;
 
@@ -125,7 +302,9 @@ inode_open (disk_sector_t sector) {
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	lock_init (&inode->grow_lock);
+	lock_set_name (&inode->grow_lock, "grow_lock");
+	buffer_cache_read (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
 	return inode;
 }
 
@@ -156,15 +335,18 @@ inode_close (struct inode *inode) {
 	if (--inode->open_cnt == 0) {
 		/* Remove from inode list and release lock. */
 		list_remove (&inode->elem);
+#ifdef VM
+		page_cache_drop (inode, inode->removed);
+#endif
 
 		/* Deallocate blocks if removed. */
 		if (inode->removed) {
 			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
+			index_truncate (&inode->data, 0,
+					bytes_to_sectors (inode->data.length));
 		}
 
-		free (inode); 
+		kmem_cache_free (&inode_cache, inode);
 	}
 }
 
@@ -183,7 +365,6 @@ off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
 
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
@@ -200,46 +381,59 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-		}
+		buffer_cache_read (sector_idx, buffer + bytes_read, sector_ofs,
+				chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
 
 	return bytes_read;
 }
 
+/* Extends INODE to LENGTH bytes, filling the new part with zeros,
+ * unless it is that long already.
+ * Returns false if the disk is full or LENGTH is too large. */
+bool
+inode_extend (struct inode *inode, off_t length) {
+	bool success = true;
+
+	if (length <= inode->data.length)
+		return true;
+	lock_acquire (&inode->grow_lock);
+	/* The length is set only once the sectors are there, so
+	 * readers never see unallocated ones. */
+	if (length > inode->data.length) {
+		struct inode_disk grown = inode->data;
+		success = inode_grow (&grown, length);
+		if (success) {
+			inode->data = grown;
+			buffer_cache_write (inode->sector, &inode->data, 0,
+					DISK_SECTOR_SIZE);
+		}
+	}
+	lock_release (&inode->grow_lock);
+	return success;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+ * A write past end of file extends INODE first, filling any gap
+ * with zeros.
  * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+ * less than SIZE if the disk is full or an error occurs. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
 
 	if (inode->deny_write_cnt)
 		return 0;
 
+	inode_extend (inode, offset + size);
+
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
 		disk_sector_t sector_idx = byte_to_sector (inode, offset);
@@ -255,34 +449,14 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
-		} else {
-			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
-		}
+		buffer_cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+				chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	free (bounce);
 
 	return bytes_written;
 }
@@ -296,6 +470,12 @@ inode_deny_write (struct inode *inode)
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
 }
 
+/* Returns true if writes to INODE are denied. */
+bool
+inode_write_denied (const struct inode *inode) {
+	return inode->deny_write_cnt > 0;
+}
+
 /* Re-enables writes to INODE.
  * Must be called once by each inode opener who has called
  * inode_deny_write() on the inode, before closing the inode. */
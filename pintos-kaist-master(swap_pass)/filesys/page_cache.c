@@ -1,9 +1,24 @@
-/* page_cache.c: Implementation of Page Cache (Buffer Cache). */
+/* page_cache.c: Implementation of Page Cache (Buffer Cache).
+ *
+ * File data is cached in 4 kB pages of type VM_PAGE_CACHE, one per
+ * (inode, page offset), found through a global index.  Such a page is
+ * mapped in no page table: read() and write() copy from and to its
+ * frame, and the pages of mmaped files link to the same frame, so
+ * there is a single copy of the data.  Frames come from the frame
+ * table and are evicted by its clock like any other. */
 
+#include <hash.h>
+#include <string.h>
 #include "vm/vm.h"
+#include "filesys/inode.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 static bool page_cache_readahead (struct page *page, void *kva);
 static bool page_cache_writeback (struct page *page);
 static void page_cache_destroy (struct page *page);
+static void page_cache_kworkerd (void *aux);
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations page_cache_op = {
@@ -15,36 +30,479 @@ static const struct page_operations page_cache_op = {
 
 tid_t page_cache_workerd;
 
+static struct hash pc_index;        /* All page cache pages. */
+/* Protects pc_index and the readahead queue.  Acquired before vlock. */
+static struct lock pc_lock;
+static struct list ra_queue;        /* Pages to read ahead. */
+static struct semaphore pc_work;    /* Wakes up the worker. */
+static bool pc_ready;               /* False until pagecache_init. */
+
+/* Pages dirtied since the last writeback; the worker writes back
+ * once PC_WRITEBACK_BATCH pages have been dirtied.  Protected by
+ * vlock, like the dirty flags. */
+static int pc_dirtied;
+#define PC_WRITEBACK_BATCH 32
+
+static uint64_t
+pc_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page_cache *pc = &hash_entry (e, struct page, he)->page_cache;
+	return hash_bytes (&pc->inode, sizeof pc->inode) ^ hash_int (pc->ofs);
+}
+
+static bool
+pc_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct page_cache *a = &hash_entry (a_, struct page, he)->page_cache;
+	const struct page_cache *b = &hash_entry (b_, struct page, he)->page_cache;
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	return a->ofs < b->ofs;
+}
+
 /* The initializer of file vm */
 void
 pagecache_init (void) {
-	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
+	hash_init (&pc_index, pc_hash, pc_less, NULL);
+	lock_init (&pc_lock);
+	lock_set_name (&pc_lock, "pc_lock");
+	list_init (&ra_queue);
+	sema_init (&pc_work, 0);
+	page_cache_workerd = thread_create ("pc-kworkerd", PRI_DEFAULT,
+			page_cache_kworkerd, NULL);
+	pc_ready = true;
 }
 
 /* Initialize the page cache */
 bool
-page_cache_initializer (struct page *page, enum vm_type type, void *kva) {
+page_cache_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &page_cache_op;
+	return true;
+}
+
+/* Returns the number of bytes of the file that page PAGE holds. */
+static off_t
+pc_valid_bytes (struct page *page) {
+	off_t left = inode_length (page->page_cache.inode) - page->page_cache.ofs;
+	return left < 0 ? 0 : left < PGSIZE ? left : PGSIZE;
+}
+
+/* Writes the file bytes of PAGE, held in KVA, back to the file. */
+static void
+pc_write_back (struct page *page, const void *kva) {
+	off_t len = pc_valid_bytes (page);
+	if (len > 0)
+		inode_write_at (page->page_cache.inode, kva, len, page->page_cache.ofs);
+}
+
+/* Returns true if a mapping of FRAME dirtied it, clearing the dirty
+ * bits on the way.
+ * Must be called with vlock held. */
+static bool
+pc_test_dirty (struct frame *frame) {
+	bool dirty = false;
+	struct list_elem *e;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *p = list_entry (e, struct page, frame_elem);
+		if (p->pml4 != NULL && pml4_is_dirty (p->pml4, p->va)) {
+			pml4_set_dirty (p->pml4, p->va, false);
+			dirty = true;
+		}
+	}
+	return dirty;
+}
+
+/* Returns the page caching the page at OFS of INODE, creating a
+ * non-resident one if CREATE.  Returns NULL if there is none or memory
+ * runs out.
+ * Must be called with pc_lock held. */
+static struct page *
+pc_get (struct inode *inode, off_t ofs, bool create) {
+	struct page key;
+	struct hash_elem *e;
+
+	key.page_cache.inode = inode;
+	key.page_cache.ofs = ofs;
+	e = hash_find (&pc_index, &key.he);
+	if (e != NULL)
+		return hash_entry (e, struct page, he);
+	if (!create)
+		return NULL;
+
+	struct page *page = kmem_cache_alloc (&vm_page_cache);
+	if (page == NULL)
+		return NULL;
+	page_cache_initializer (page, VM_PAGE_CACHE, NULL);
+	page->va = NULL;
+	page->frame = NULL;
+	page->writable = true;
+	page->pml4 = NULL;
+	page->page_cache = (struct page_cache) {
+		.inode = inode,
+		.ofs = ofs,
+	};
+	hash_insert (&pc_index, &page->he);
+	return page;
+}
+
+/* Brings PAGE in if needed and returns its frame, pinned.  Returns
+ * NULL if it cannot be read.
+ * Must be called with pc_lock held. */
+static struct frame *
+pc_pin (struct page *page) {
+	for (;;) {
+		struct frame *frame = vm_frame_pin (page);
+		if (frame != NULL)
+			return frame;
+		/* Not resident, or evicted again before it could be pinned. */
+		if (!vm_do_claim_page (page))
+			return NULL;
+	}
+}
+
+/* Queues the page at OFS of INODE, LENGTH bytes long, for the worker
+ * to read ahead.
+ * Must be called with pc_lock held. */
+static void
+pc_queue_readahead (struct inode *inode, off_t ofs, off_t length) {
+	if (ofs >= length)
+		return;
+	struct page *page = pc_get (inode, ofs, true);
+	if (page == NULL || page->frame != NULL || page->page_cache.queued)
+		return;
+	page->page_cache.queued = true;
+	list_push_back (&ra_queue, &page->page_cache.ra_elem);
+	sema_up (&pc_work);
+}
+
+/* Has the worker read the pages holding SIZE bytes at OFFSET of INODE
+ * into the cache in the background, as far as there are free frames. */
+void
+page_cache_prefetch (struct inode *inode, off_t offset, off_t size) {
+	off_t length, ofs;
+
+	if (!pc_ready || size <= 0)
+		return;
+	length = inode_length (inode);
+	lock_acquire (&pc_lock);
+	for (ofs = offset - offset % PGSIZE; ofs < offset + size; ofs += PGSIZE)
+		pc_queue_readahead (inode, ofs, length);
+	lock_release (&pc_lock);
+}
+
+/* Marks PAGE dirty, waking the worker up to write back every
+ * PC_WRITEBACK_BATCH newly dirtied pages.
+ * Must be called with vlock held. */
+static void
+pc_set_dirty (struct page *page) {
+	if (!page->page_cache.dirty) {
+		page->page_cache.dirty = true;
+		if (++pc_dirtied == PC_WRITEBACK_BATCH)
+			sema_up (&pc_work);
+	}
+}
+
+/* Returns true if the cache page in FRAME has to be written back
+ * before the frame can be reused, and has the worker write the cache
+ * back soon in that case.  Lets the evictor pass over dirty pages
+ * instead of writing them itself.
+ * Must be called with vlock held. */
+bool
+page_cache_test_dirty (struct frame *frame) {
+	struct page *page = frame->page;
+
+	ASSERT (VM_TYPE (page->operations->type) == VM_PAGE_CACHE);
+	if (pc_test_dirty (frame))
+		pc_set_dirty (page);
+	if (!page->page_cache.dirty)
+		return false;
+	if (pc_dirtied < PC_WRITEBACK_BATCH) {
+		pc_dirtied = PC_WRITEBACK_BATCH;
+		sema_up (&pc_work);
+	}
+	return true;
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET,
+ * through the cache.
+ * Returns the number of bytes actually read, which may be less than
+ * SIZE at end of file or if memory runs out. */
+off_t
+page_cache_read (struct inode *inode, void *buffer_, off_t size,
+		off_t offset) {
+	uint8_t *buffer = buffer_;
+	off_t bytes_read = 0;
+	off_t length;
+
+	/* The free map is read before the VM is up. */
+	if (!pc_ready)
+		return inode_read_at (inode, buffer_, size, offset);
+
+	length = inode_length (inode);
+	while (size > 0) {
+		int page_ofs = offset % PGSIZE;
+		off_t inode_left = length - offset;
+		int page_left = PGSIZE - page_ofs;
+		int min_left = inode_left < page_left ? inode_left : page_left;
+		int chunk_size = size < min_left ? size : min_left;
+		struct frame *frame = NULL;
+		struct page *page;
+
+		if (chunk_size <= 0)
+			break;
+
+		lock_acquire (&pc_lock);
+		page = pc_get (inode, offset - page_ofs, true);
+		if (page != NULL) {
+			frame = pc_pin (page);
+			page->page_cache.accessed = true;
+		}
+		lock_release (&pc_lock);
+		if (frame == NULL)
+			break;
+
+		/* BUFFER may fault, so copy without pc_lock. */
+		memcpy (buffer + bytes_read, (uint8_t *) frame->kva + page_ofs,
+				chunk_size);
+		vm_frame_unpin (frame);
+
+		size -= chunk_size;
+		offset += chunk_size;
+		bytes_read += chunk_size;
+	}
+	return bytes_read;
+}
 
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+ * through the cache.  The data reaches the disk when the page is
+ * evicted or written back.  A write past end of file extends INODE
+ * first.
+ * Returns the number of bytes actually written, which may be less
+ * than SIZE if writes are denied, the disk is full or memory runs
+ * out. */
+off_t
+page_cache_write (struct inode *inode, const void *buffer_, off_t size,
+		off_t offset) {
+	const uint8_t *buffer = buffer_;
+	off_t bytes_written = 0;
+
+	if (!pc_ready)
+		return inode_write_at (inode, buffer_, size, offset);
+	if (inode_write_denied (inode))
+		return 0;
+	/* Only grow the inode here: BUFFER may fault, so it is copied
+	 * into the pinned cache pages below, never under a file system
+	 * lock. */
+	if (!inode_extend (inode, offset + size)) {
+		off_t length = inode_length (inode);
+		size = offset < length ? length - offset : 0;
+	}
+
+	while (size > 0) {
+		int page_ofs = offset % PGSIZE;
+		int chunk_size = size < PGSIZE - page_ofs ? size : PGSIZE - page_ofs;
+		struct frame *frame = NULL;
+		struct page *page;
+
+		lock_acquire (&pc_lock);
+		page = pc_get (inode, offset - page_ofs, true);
+		if (page != NULL) {
+			frame = pc_pin (page);
+			page->page_cache.accessed = true;
+		}
+		lock_release (&pc_lock);
+		if (frame == NULL)
+			break;
+
+		memcpy ((uint8_t *) frame->kva + page_ofs, buffer + bytes_written,
+				chunk_size);
+		/* Dirty after the copy, so that a flush racing it writes the
+		 * page again. */
+		lock_acquire (&vlock);
+		pc_set_dirty (page);
+		lock_release (&vlock);
+		vm_frame_unpin (frame);
+
+		size -= chunk_size;
+		offset += chunk_size;
+		bytes_written += chunk_size;
+	}
+	return bytes_written;
+}
+
+/* Maps PAGE, a page of an mmaped file, to the frame of the cache page
+ * holding the same part of the file. */
+bool
+page_cache_map (struct page *page) {
+	struct file_page *file_page = &page->file;
+	struct inode *inode = file_get_inode (file_page->file);
+	struct frame *frame = NULL;
+	bool success;
+
+	lock_acquire (&pc_lock);
+	struct page *cp = pc_get (inode, file_page->ofs, true);
+	if (cp != NULL)
+		frame = pc_pin (cp);
+	lock_release (&pc_lock);
+	if (frame == NULL)
+		return false;
+
+	success = vm_frame_install (frame, page);
+	vm_frame_unpin (frame);
+	return success;
+}
+
+/* Unmaps PAGE, a page of an mmaped file, handing what it wrote to
+ * the cache page. */
+void
+page_cache_unmap (struct page *page) {
+	lock_acquire (&vlock);
+	struct frame *frame = page->frame;
+	if (frame != NULL && pml4_is_dirty (page->pml4, page->va)) {
+		struct page *cp = frame->page;
+		ASSERT (VM_TYPE (cp->operations->type) == VM_PAGE_CACHE);
+		pc_set_dirty (cp);
+	}
+	lock_release (&vlock);
+	vm_frame_release (page);
+}
+
+/* Writes back every dirty page of the cache. */
+void
+page_cache_flush (void) {
+	struct hash_iterator i;
+
+	if (!pc_ready)
+		return;
+	lock_acquire (&pc_lock);
+	lock_acquire (&vlock);
+	pc_dirtied = 0;
+	lock_release (&vlock);
+	hash_first (&i, &pc_index);
+	while (hash_next (&i)) {
+		struct page *page = hash_entry (hash_cur (&i), struct page, he);
+		bool dirty = false;
+
+		lock_acquire (&vlock);
+		struct frame *frame = page->frame;
+		if (frame != NULL) {
+			dirty = pc_test_dirty (frame) || page->page_cache.dirty;
+			page->page_cache.dirty = false;
+			if (dirty)
+				frame->pin_cnt++;
+		}
+		lock_release (&vlock);
+		if (dirty) {
+			pc_write_back (page, frame->kva);
+			vm_frame_unpin (frame);
+		}
+	}
+	lock_release (&pc_lock);
+}
+
+/* Drops the cached pages of INODE, which is being closed for the last
+ * time, writing dirty ones back unless DISCARD. */
+void
+page_cache_drop (struct inode *inode, bool discard) {
+	struct hash_iterator i;
+	struct list victims;
+
+	if (!pc_ready)
+		return;
+	list_init (&victims);
+	lock_acquire (&pc_lock);
+	hash_first (&i, &pc_index);
+	while (hash_next (&i)) {
+		struct page *page = hash_entry (hash_cur (&i), struct page, he);
+		if (page->page_cache.inode == inode) {
+			if (page->page_cache.queued)
+				list_remove (&page->page_cache.ra_elem);
+			list_push_back (&victims, &page->page_cache.ra_elem);
+		}
+	}
+	while (!list_empty (&victims)) {
+		struct page *page = list_entry (list_pop_front (&victims), struct page,
+				page_cache.ra_elem);
+		hash_delete (&pc_index, &page->he);
+
+		lock_acquire (&vlock);
+		if (page->frame != NULL && !discard
+				&& (pc_test_dirty (page->frame) || page->page_cache.dirty))
+			pc_write_back (page, page->frame->kva);
+		lock_release (&vlock);
+		vm_dealloc_page (page);
+	}
+	lock_release (&pc_lock);
 }
 
 /* Utilze the Swap in mechanism to implement readhead */
 static bool
 page_cache_readahead (struct page *page, void *kva) {
+	off_t read_b = pc_valid_bytes (page);
+	if (read_b > 0 && inode_read_at (page->page_cache.inode, kva, read_b,
+				page->page_cache.ofs) != read_b)
+		return false;
+	memset ((uint8_t *) kva + read_b, 0, PGSIZE - read_b);
+	return true;
 }
 
-/* Utilze the Swap out mechanism to implement writeback */
+/* Utilze the Swap out mechanism to implement writeback.
+ * Unmaps every mapping of the frame and writes the page back if it or
+ * any mapping dirtied it.  Called by the evictor with vlock held, so
+ * the evictor prefers clean pages (see page_cache_test_dirty) and
+ * leaves dirty ones to the worker. */
 static bool
 page_cache_writeback (struct page *page) {
+	struct frame *frame = page->frame;
+	bool dirty = pc_test_dirty (frame) || page->page_cache.dirty;
+
+	while (!list_empty (&frame->pages)) {
+		struct page *p = list_entry (list_pop_front (&frame->pages),
+				struct page, frame_elem);
+		if (p->pml4 != NULL)
+			pml4_clear_page (p->pml4, p->va);
+		p->frame = NULL;
+	}
+	if (dirty) {
+		pc_write_back (page, frame->kva);
+		page->page_cache.dirty = false;
+	}
+	frame->page = NULL;
+	frame->ref_cnt = 0;
+	return true;
 }
 
 /* Destory the page_cache. */
 static void
 page_cache_destroy (struct page *page) {
+	if (page->frame != NULL)
+		vm_frame_release (page);
 }
 
-/* Worker thread for page cache */
+/* Worker thread for page cache.  Reads queued pages ahead into free
+ * frames, never evicting for them, and writes dirty pages back in
+ * batches. */
 static void
-page_cache_kworkerd (void *aux) {
+page_cache_kworkerd (void *aux UNUSED) {
+	for (;;) {
+		sema_down (&pc_work);
+
+		lock_acquire (&pc_lock);
+		while (!list_empty (&ra_queue)) {
+			struct page *page = list_entry (list_pop_front (&ra_queue),
+					struct page, page_cache.ra_elem);
+			page->page_cache.queued = false;
+			if (page->frame == NULL) {
+				struct frame *frame = vm_get_free_frame ();
+				if (frame != NULL)
+					vm_claim_frame (page, frame);
+			}
+		}
+		lock_release (&pc_lock);
+
+		if (pc_dirtied >= PC_WRITEBACK_BATCH)
+			page_cache_flush ();
+	}
 }
@@ -2,7 +2,9 @@
 #define DEVICES_DISK_H
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdint.h>
+#include "threads/synch.h"
 
 /* Size of a disk sector in bytes. */
 #define DISK_SECTOR_SIZE 512
@@ -15,6 +17,25 @@ typedef uint32_t disk_sector_t;
  * printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
 
+/* Maximum number of sectors moved by one disk_read_n(),
+ * disk_write_n(), disk_readv() or disk_writev() call, the limit of the ATA sector count
+ * register. */
+#define DISK_MULTI_MAX 256
+
+/* An asynchronous transfer, set up by disk_request_init() and
+ * queued by disk_submit().  disk_wait() blocks until it is done. */
+struct disk_request {
+	struct disk *disk;          /* Disk to transfer from or to. */
+	disk_sector_t sec_no;       /* First sector. */
+	bool write;                 /* True to write, false to read. */
+	void *const *bufs;          /* BUF_CNT buffers... */
+	size_t buf_cnt;
+	size_t buf_sectors;         /* ...of BUF_SECTORS sectors each. */
+
+	struct list_elem elem;      /* Channel queue element. */
+	struct semaphore done;      /* Up'd when the transfer completes. */
+};
+
 void disk_init (void);
 void disk_print_stats (void);
 
@@ -22,6 +43,17 @@ struct disk *disk_get (int chan_no, int dev_no);
 disk_sector_t disk_size (struct disk *);
 void disk_read (struct disk *, disk_sector_t, void *);
 void disk_write (struct disk *, disk_sector_t, const void *);
+void disk_read_n (struct disk *, disk_sector_t, void *, size_t cnt);
+void disk_write_n (struct disk *, disk_sector_t, const void *, size_t cnt);
+void disk_readv (struct disk *, disk_sector_t, void *const bufs[],
+		size_t buf_cnt, size_t buf_sectors);
+void disk_writev (struct disk *, disk_sector_t, const void *const bufs[],
+		size_t buf_cnt, size_t buf_sectors);
+
+void disk_request_init (struct disk_request *, struct disk *, disk_sector_t,
+		bool write, void *const bufs[], size_t buf_cnt, size_t buf_sectors);
+void disk_submit (struct disk_request *);
+void disk_wait (struct disk_request *);
 
 void 	register_disk_inspect_intr ();
 #endif /* devices/disk.h */
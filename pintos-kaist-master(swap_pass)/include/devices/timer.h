@@ -1,7 +1,9 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <heap.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
@@ -20,4 +22,25 @@ void timer_nsleep (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
+extern bool timer_tickless;
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
+/* A one-shot kernel timer.  Once armed, FUNC(AUX) is called from
+   the timer interrupt at the first tick at or after EXPIRES, unless
+   the timer is cancelled first. */
+typedef void timer_event_func (void *aux);
+struct timer_event {
+	int64_t expires;                /* Tick to fire at. */
+	timer_event_func *func;         /* Callback. */
+	void *aux;                      /* Callback argument. */
+	bool armed;                     /* In the heap of armed timers? */
+	struct heap_elem elem;          /* Heap element. */
+};
+
+void timer_event_init (struct timer_event *, timer_event_func *, void *aux);
+void timer_event_arm (struct timer_event *, int64_t expires);
+bool timer_event_cancel (struct timer_event *);
+int64_t timer_next_deadline (void);
+
 #endif /* devices/timer.h */
@@ -0,0 +1,14 @@
+#ifndef FILESYS_BUFFER_CACHE_H
+#define FILESYS_BUFFER_CACHE_H
+
+#include "devices/disk.h"
+
+/* Number of sectors held by the buffer cache. */
+#define BUFFER_CACHE_SIZE 64
+
+void buffer_cache_init (void);
+void buffer_cache_read (disk_sector_t, void *, int ofs, int size);
+void buffer_cache_write (disk_sector_t, const void *, int ofs, int size);
+void buffer_cache_flush (void);
+
+#endif /* filesys/buffer_cache.h */
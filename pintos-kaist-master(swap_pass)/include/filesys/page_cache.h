@@ -1,12 +1,35 @@
 #ifndef FILESYS_PAGE_CACHE_H
 #define FILESYS_PAGE_CACHE_H
-#include "vm/vm.h"
+#include <list.h>
+#include "filesys/off_t.h"
 
 struct page;
+struct frame;
+struct inode;
 enum vm_type;
 
-struct page_cache {};
+/* A page of file data, shared by read()/write() and every mmap of the
+ * same part of the file.  It lives in the page cache index and is
+ * mapped in no page table; mmaped pages map its frame. */
+struct page_cache {
+	struct inode *inode;        /* Cached file. */
+	off_t ofs;                  /* Page-aligned offset in INODE. */
+	bool dirty;                 /* Written through write() or a mapping.
+	                               Protected by vlock. */
+	bool accessed;              /* Used since the clock last passed. */
+	bool queued;                /* In the readahead queue. */
+	struct list_elem ra_elem;   /* Readahead queue element. */
+};
 
-void page_cache_init (void);
+void pagecache_init (void);
 bool page_cache_initializer (struct page *page, enum vm_type type, void *kva);
+off_t page_cache_read (struct inode *, void *, off_t size, off_t offset);
+off_t page_cache_write (struct inode *, const void *, off_t size,
+		off_t offset);
+void page_cache_prefetch (struct inode *, off_t offset, off_t size);
+bool page_cache_map (struct page *page);
+void page_cache_unmap (struct page *page);
+void page_cache_drop (struct inode *, bool discard);
+void page_cache_flush (void);
+bool page_cache_test_dirty (struct frame *);
 #endif
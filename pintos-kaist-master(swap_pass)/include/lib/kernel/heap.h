@@ -0,0 +1,55 @@
+#ifndef __LIB_KERNEL_HEAP_H
+#define __LIB_KERNEL_HEAP_H
+
+/* Priority queue.
+ *
+ * A pairing heap that, like the list in list.h, needs no dynamic
+ * memory: each structure that can be in a heap embeds a struct
+ * heap_elem, and heap_entry() converts back to the containing
+ * structure.  The heap keeps the "least" element, as defined by
+ * the heap's less function, at the top.
+ *
+ * Pushing is O(1); popping and removing an arbitrary element are
+ * O(log n) amortized.  An element whose key changes must be
+ * removed and pushed again. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Heap element. */
+struct heap_elem {
+	struct heap_elem *child;        /* First child. */
+	struct heap_elem *sibling;      /* Next sibling. */
+	struct heap_elem *prev;         /* Parent if first child, else
+	                                   previous sibling. */
+};
+
+/* Compares the value of two heap elements A and B, given
+ * auxiliary data AUX.  Returns true if A is less than B, or
+ * false if A is greater than or equal to B. */
+typedef bool heap_less_func (const struct heap_elem *a,
+                             const struct heap_elem *b,
+                             void *aux);
+
+/* Heap. */
+struct heap {
+	struct heap_elem *top;          /* Least element, or null. */
+	heap_less_func *less;           /* Ordering. */
+	void *aux;                      /* Auxiliary data for LESS. */
+};
+
+/* Converts pointer to heap element HEAP_ELEM into a pointer to
+   the structure that HEAP_ELEM is embedded inside. */
+#define heap_entry(HEAP_ELEM, STRUCT, MEMBER)           \
+	((STRUCT *) ((uint8_t *) &(HEAP_ELEM)->child    \
+		- offsetof (STRUCT, MEMBER.child)))
+
+void heap_init (struct heap *, heap_less_func *, void *aux);
+bool heap_empty (const struct heap *);
+struct heap_elem *heap_top (const struct heap *);
+void heap_push (struct heap *, struct heap_elem *);
+struct heap_elem *heap_pop (struct heap *);
+void heap_remove (struct heap *, struct heap_elem *);
+
+#endif /* lib/kernel/heap.h */
@@ -0,0 +1,34 @@
+#ifndef THREADS_KMEM_H
+#define THREADS_KMEM_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* Constructor for the objects of a cache. */
+typedef void kmem_ctor_func (void *obj);
+
+/* A cache of objects of one type, kept in page-sized slabs. */
+struct kmem_cache {
+	const char *name;           /* For kmem_print_stats(). */
+	size_t obj_size;            /* Size of an object. */
+	size_t stride;              /* Distance between objects in a slab. */
+	size_t objs_per_slab;       /* Objects in a slab. */
+	kmem_ctor_func *ctor;       /* Constructor, or null. */
+	struct lock lock;           /* Protects the members below. */
+	struct list partial;        /* Slabs with at least one free object. */
+	size_t slab_cnt;            /* Slabs held. */
+	size_t in_use;              /* Objects handed out. */
+	size_t peak;                /* Largest IN_USE so far. */
+	struct list_elem elem;      /* Element in the list of all caches. */
+};
+
+void kmem_init (void);
+void kmem_cache_init (struct kmem_cache *, const char *name, size_t size,
+		kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void *kmem_cache_zalloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+void kmem_print_stats (void);
+
+#endif /* threads/kmem.h */
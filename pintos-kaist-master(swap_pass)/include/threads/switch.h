@@ -0,0 +1,27 @@
+#ifndef THREADS_SWITCH_H
+#define THREADS_SWITCH_H
+
+#include <stdint.h>
+
+/* switch_threads()'s stack frame, as left on the stack of a
+ * thread that is switched out.  Only the callee-saved registers
+ * are kept; everything else was already saved by the caller. */
+struct switch_threads_frame {
+	uint64_t r15;
+	uint64_t r14;
+	uint64_t r13;
+	uint64_t r12;
+	uint64_t rbp;
+	uint64_t rbx;
+	void (*rip) (void);         /* Return address. */
+};
+
+/* Saves the running thread's stack pointer in *CUR_RSP and
+ * resumes the thread whose stack pointer is NEXT_RSP. */
+void switch_threads (uint64_t *cur_rsp, uint64_t next_rsp);
+
+/* Where a new thread first "returns" to.  Calls the function in
+ * rbx with r12 and r13 as its arguments. */
+void switch_entry (void);
+
+#endif /* threads/switch.h */
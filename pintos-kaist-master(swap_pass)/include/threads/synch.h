@@ -1,16 +1,40 @@
 #ifndef THREADS_SYNCH_H
 #define THREADS_SYNCH_H
 
+#include <heap.h>
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
+
+/* Contention statistics shared by every lock, semaphore or
+   spinlock given the same name.  Only kept with -lockstat.  Waits
+   and holds are measured in timer ticks. */
+struct lock_stat {
+	char name[16];              /* Name given to sema_set_name() etc. */
+	unsigned acquired;          /* Successful downs or acquires. */
+	unsigned contended;         /* Of those, how many had to wait. */
+	int64_t wait_ticks;         /* Total time spent waiting. */
+	int64_t max_wait;           /* Longest single wait. */
+	int64_t hold_ticks;         /* Total time held (locks only). */
+};
+
+/* If true, named locks keep a struct lock_stat.  Controlled by
+   kernel command-line option "-lockstat". */
+extern bool lock_profiling;
+
+void lock_print_stats (void);
 
 /* A counting semaphore. */
 struct semaphore {
 	unsigned value;             /* Current value. */
-	struct list waiters;        /* List of waiting threads. */
+	struct heap waiters;        /* Waiting threads, highest priority
+	                               first. */
+	struct lock_stat *stat;     /* Statistics, or null if unnamed. */
 };
 
 void sema_init (struct semaphore *, unsigned value);
+void sema_set_name (struct semaphore *, const char *name);
 void sema_down (struct semaphore *);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
@@ -20,27 +44,43 @@ void sema_self_test (void);
 struct lock {
 	struct thread *holder;      /* Thread holding lock (for debugging). */
 	struct semaphore semaphore; /* Binary semaphore controlling access. */
+	struct list_elem elem;      /* Element in holder's held_locks. */
+	int64_t acquired_at;        /* When HOLDER acquired it, if named. */
 };
 
 void lock_init (struct lock *);
+void lock_set_name (struct lock *, const char *name);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
+/* Spinlock.  Holding one keeps interrupts off, so it may be taken
+   from interrupt context and never sleeps; the atomic flag is what
+   excludes other processors. */
+struct spinlock {
+	volatile int locked;        /* 1 if held, 0 otherwise. */
+	enum intr_level old_level;  /* Interrupt level to restore. */
+	struct lock_stat *stat;     /* Statistics, or null if unnamed. */
+};
+
+void spinlock_init (struct spinlock *);
+void spinlock_set_name (struct spinlock *, const char *name);
+void spin_lock (struct spinlock *);
+void spin_unlock (struct spinlock *);
+
 /* Condition variable. */
 struct condition {
-	struct list waiters;        /* List of waiting threads. */
+	struct heap waiters;        /* Waiting threads, highest priority
+	                               first. */
 };
 
 void cond_init (struct condition *);
 void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
-void release_d(struct lock *lock);
 void donate(void);
 void refresh(void);
-bool sepm(const struct list_elem *a,const struct list_elem *b,void *aux);
 
 /* Optimization barrier.
  *
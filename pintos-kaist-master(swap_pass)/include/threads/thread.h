@@ -5,6 +5,7 @@
 #include <list.h>
 #include <stdint.h>
 #include "threads/interrupt.h"
+#include "devices/timer.h"
 #include "synch.h"
 #define VM
 #ifdef VM
@@ -30,6 +31,8 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 #define fp 1<<14
+#define NICE_MIN -20
+#define NICE_MAX 20
 #define NICE_DEFAULT 0
 #define RECENT_CPU_DEFAULT 0
 #define LOAD_AVG_DEFAULT 0
@@ -99,14 +102,21 @@ struct thread {
 	int priority;                       /* Priority. */
 	int opriority;
 	struct lock *wait;
-	struct list donates;
-	struct list_elem delem;
+	struct list held_locks;             /* Locks held, for donation. */
+	struct heap *wait_heap;             /* Semaphore waiters we are in. */
+	struct heap_elem welem;             /* Element in WAIT_HEAP. */
+	struct heap *cond_heap;             /* Condition waiters we are in. */
+	struct heap_elem *cond_elem;        /* Our element in COND_HEAP. */
+	unsigned wait_seq;                  /* Keeps equal priorities FIFO. */
 	int exit_s;
 	/* Shared between thread.c and synch.c. */
 	struct list_elem elem;              /* List element. */
-	int64_t wakeup;
+	struct timer_event sleep_timer;     /* Wakes the thread from thread_sleep(). */
 	int nice;
 	int recent_cpu;
+	int64_t decay_epoch;                /* Seconds of decay applied to recent_cpu. */
+	int64_t vruntime;                   /* Fair-share virtual runtime. */
+	struct heap_elem relem;             /* Element in fair-share queue. */
 	struct list_elem allelem;
 	struct file * running;
 	int fdcnt;
@@ -130,7 +140,7 @@ struct thread {
 #endif
 
 	/* Owned by thread.c. */
-	struct intr_frame tf;               /* Information for switching */
+	uint64_t switch_rsp;                /* Saved stack pointer while switched out. */
 	unsigned magic;                     /* Detects stack overflow. */
 };
 
@@ -139,10 +149,16 @@ struct thread {
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* If true, use the fair-share scheduler.  Controlled by kernel
+   command-line options "-cfs" and "-cfs-gran". */
+extern bool thread_cfs;
+extern int thread_cfs_granularity;
+
 void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_account_idle (void);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
@@ -160,6 +176,7 @@ void thread_yield (void);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_set_effective_priority (struct thread *, int);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
@@ -168,8 +185,6 @@ int thread_get_load_avg (void);
 
 void do_iret (struct intr_frame *tf);
 void thread_sleep(int64_t tiks);
-void thread_wakeup(int64_t tiks);
-bool thread_order(struct list_elem *a,struct list_elem *b,void *aux);
 void test_max_priority (void);
 int convert_fixed(int n);
 int convert_int(int x);
@@ -179,8 +194,9 @@ void up_recent(void);
 void recal_load(void);
 void recal_recent(struct thread *t);
 void recal_pri(struct thread *vv);
-void all_recal(void);
-void all_recal_r(void);
+void recal_quantum(void);
+void recal_decay(void);
+#define FDT_SIZE      128                   /* Entries in an fd table. */
 #define FDT_PAGES     3                     // test `multi-oom` 테스트용
 #define FDCOUNT_LIMIT FDT_PAGES * (1 << 9)
 #endif /* threads/thread.h */
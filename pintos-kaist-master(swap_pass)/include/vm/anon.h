@@ -2,13 +2,19 @@
 #define VM_ANON_H
 #include "vm/vm.h"
 struct page;
+struct frame;
 enum vm_type;
 
+/* Most frames the evictor writes to swap with one disk command. */
+#define SWAP_CLUSTER 8
+
 struct anon_page {
     size_t pageno;
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+void anon_swap_dup (struct page *page);
+size_t anon_swap_out_cluster (struct frame *frames[], size_t cnt);
 
 #endif
@@ -2,6 +2,7 @@
 #define VM_VM_H
 #include <stdbool.h>
 #include "threads/palloc.h"
+#include "threads/kmem.h"
 #include <hash.h>
 enum vm_type {
 	/* page not initialized */
@@ -27,9 +28,7 @@ enum vm_type {
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
-#ifdef EFILESYS
 #include "filesys/page_cache.h"
-#endif
 
 struct page_operations;
 struct thread;
@@ -50,15 +49,15 @@ struct page {
 	bool writable;
 	int fbtc;
 	int fbcc;
+	uint64_t *pml4;                /* Page table that maps this page. */
+	struct list_elem frame_elem;   /* Element in frame's sharer list. */
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
 	union {
 		struct uninit_page uninit;
 		struct anon_page anon;
 		struct file_page file;
-#ifdef EFILESYS
 		struct page_cache page_cache;
-#endif
 	};
 };
 struct load_arg{
@@ -68,11 +67,18 @@ struct load_arg{
 	size_t zero_b;
 	bool enablerw;
 };
-/* The representation of "frame" */
+/* The representation of "frame".
+ * After fork, one frame may be shared read-only by the pages of the
+ * parent and the child (copy-on-write).  PAGES holds every page that
+ * maps this frame, REF_CNT is its length, and PAGE is one of them whose
+ * page_operations handle the eviction of the frame. */
 struct frame {
 	void *kva;
 	struct page *page;
 	struct list_elem ft_elem;
+	struct list pages;          /* Pages sharing this frame. */
+	int ref_cnt;                /* Number of pages in PAGES. */
+	int pin_cnt;                /* Never evicted while nonzero. */
 };
 
 /* The function table for page operations.
@@ -108,6 +114,13 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
+/* Protects the frame table and the sharing of frames. */
+extern struct lock vlock;
+extern struct kmem_cache vm_page_cache;
+extern struct kmem_cache load_arg_cache;
+extern size_t vm_free_low;
+extern size_t vm_free_high;
+
 void vm_init (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
@@ -118,6 +131,15 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+bool vm_do_claim_page (struct page *page);
+bool vm_claim_frame (struct page *page, struct frame *frame);
+void vm_frame_link (struct frame *frame, struct page *page);
+void vm_frame_release (struct page *page);
+struct frame *vm_get_free_frame (void);
+void vm_put_frame (struct frame *frame);
+bool vm_frame_install (struct frame *frame, struct page *page);
+struct frame *vm_frame_pin (struct page *page);
+void vm_frame_unpin (struct frame *frame);
 enum vm_type page_get_type (struct page *page);
 uint64_t hash_page(const struct hash_elem *e, void *aux);
 bool hash_addr_comp(const struct hash_elem *a, const struct hash_elem *b, void *aux);
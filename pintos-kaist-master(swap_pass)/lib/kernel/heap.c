@@ -0,0 +1,129 @@
+#include "heap.h"
+#include "../debug.h"
+
+/* Our heap is a pairing heap: a tree in which every node is no
+   greater than its children, stored as child/sibling links.  The
+   `prev' link lets an element be cut out of the middle of the
+   tree, which heap_remove() needs. */
+
+/* Links trees A and B, either of which may be null, and returns
+   the root of the result.  A and B must have no siblings. */
+static struct heap_elem *
+meld (struct heap *h, struct heap_elem *a, struct heap_elem *b) {
+	if (a == NULL)
+		return b;
+	if (b == NULL)
+		return a;
+	if (h->less (b, a, h->aux)) {
+		struct heap_elem *tmp = a;
+		a = b;
+		b = tmp;
+	}
+	b->sibling = a->child;
+	if (b->sibling != NULL)
+		b->sibling->prev = b;
+	b->prev = a;
+	a->child = b;
+	return a;
+}
+
+/* Melds the sibling list starting at FIRST into one tree, in the
+   usual two passes, and returns its root. */
+static struct heap_elem *
+meld_pairs (struct heap *h, struct heap_elem *first) {
+	struct heap_elem *pairs = NULL;
+	struct heap_elem *root = NULL;
+
+	/* Meld adjacent pairs left to right, stacking the results. */
+	while (first != NULL) {
+		struct heap_elem *a = first;
+		struct heap_elem *b = a->sibling;
+
+		first = b != NULL ? b->sibling : NULL;
+		a->sibling = a->prev = NULL;
+		if (b != NULL)
+			b->sibling = b->prev = NULL;
+		a = meld (h, a, b);
+		a->sibling = pairs;
+		pairs = a;
+	}
+
+	/* Meld the pairs right to left. */
+	while (pairs != NULL) {
+		struct heap_elem *next = pairs->sibling;
+
+		pairs->sibling = NULL;
+		root = meld (h, root, pairs);
+		pairs = next;
+	}
+	return root;
+}
+
+/* Initializes H as an empty heap ordered by LESS given auxiliary
+   data AUX. */
+void
+heap_init (struct heap *h, heap_less_func *less, void *aux) {
+	ASSERT (h != NULL);
+	ASSERT (less != NULL);
+
+	h->top = NULL;
+	h->less = less;
+	h->aux = aux;
+}
+
+/* Returns true if H is empty, false otherwise. */
+bool
+heap_empty (const struct heap *h) {
+	return h->top == NULL;
+}
+
+/* Returns the least element in H, or a null pointer if H is
+   empty. */
+struct heap_elem *
+heap_top (const struct heap *h) {
+	return h->top;
+}
+
+/* Inserts ELEM into H. */
+void
+heap_push (struct heap *h, struct heap_elem *elem) {
+	ASSERT (h != NULL);
+	ASSERT (elem != NULL);
+
+	elem->child = elem->sibling = elem->prev = NULL;
+	h->top = meld (h, h->top, elem);
+}
+
+/* Removes and returns the least element in H, which must not be
+   empty. */
+struct heap_elem *
+heap_pop (struct heap *h) {
+	struct heap_elem *top = h->top;
+
+	ASSERT (top != NULL);
+	h->top = meld_pairs (h, top->child);
+	return top;
+}
+
+/* Removes ELEM, which must be in H, from H. */
+void
+heap_remove (struct heap *h, struct heap_elem *elem) {
+	struct heap_elem *sub;
+
+	if (elem == h->top) {
+		heap_pop (h);
+		return;
+	}
+
+	/* Cut ELEM out of its parent's child list. */
+	ASSERT (elem->prev != NULL);
+	if (elem->prev->child == elem)
+		elem->prev->child = elem->sibling;
+	else
+		elem->prev->sibling = elem->sibling;
+	if (elem->sibling != NULL)
+		elem->sibling->prev = elem->prev;
+
+	sub = meld_pairs (h, elem->child);
+	h->top = meld (h, h->top, sub);
+}
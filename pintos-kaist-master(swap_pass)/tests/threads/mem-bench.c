@@ -0,0 +1,113 @@
+/* Measures the throughput of the kernel's block memory functions
+   on whole pages, in bytes per timer tick, next to plain byte
+   loops that stand in for the old implementations. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+
+/* Ticks to run each function for. */
+#define BENCH_TICKS 20
+
+static uint8_t *dst, *src;
+
+static void
+byte_copy (void) 
+{
+  size_t i;
+
+  for (i = 0; i < PGSIZE; i++)
+    dst[i] = src[i];
+}
+
+static void
+byte_set (void) 
+{
+  size_t i;
+
+  for (i = 0; i < PGSIZE; i++)
+    dst[i] = 0;
+}
+
+static void
+do_memcpy (void) 
+{
+  memcpy (dst, src, PGSIZE);
+}
+
+static void
+do_memmove (void) 
+{
+  memmove (dst, src, PGSIZE);
+}
+
+static void
+do_memset (void) 
+{
+  memset (dst, 0, PGSIZE);
+}
+
+static void
+do_memcmp (void) 
+{
+  if (memcmp (dst, src, PGSIZE) != 0)
+    fail ("pages differ");
+}
+
+static void
+do_copy_page (void) 
+{
+  copy_page (dst, src);
+}
+
+static void
+do_clear_page (void) 
+{
+  clear_page (dst);
+}
+
+/* Runs FUNC over and over for BENCH_TICKS ticks and reports the
+   bytes it processed per tick. */
+static void
+bench (const char *name, void (*func) (void)) 
+{
+  int64_t start, bytes = 0;
+
+  /* Start at a tick boundary. */
+  start = timer_ticks ();
+  while (timer_ticks () == start)
+    continue;
+
+  start = timer_ticks ();
+  while (timer_elapsed (start) < BENCH_TICKS) 
+    {
+      func ();
+      bytes += PGSIZE;
+    }
+  msg ("%s: %"PRId64" bytes/tick", name, bytes / BENCH_TICKS);
+}
+
+void
+test_mem_bench (void) 
+{
+  dst = palloc_get_page (PAL_ASSERT);
+  src = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+
+  bench ("byte loop copy", byte_copy);
+  bench ("memcpy", do_memcpy);
+  bench ("memmove", do_memmove);
+  bench ("copy_page", do_copy_page);
+  bench ("byte loop set", byte_set);
+  bench ("memset", do_memset);
+  bench ("clear_page", do_clear_page);
+  bench ("memcmp", do_memcmp);
+
+  palloc_free_page (dst);
+  palloc_free_page (src);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+foreach my $name ('byte loop copy', 'memcpy', 'memmove', 'copy_page',
+		  'byte loop set', 'memset', 'clear_page', 'memcmp') {
+    fail "missing $name report\n"
+      if !grep (/^\(mem-bench\) \Q$name\E: \d+ bytes\/tick$/, @output);
+}
+pass;
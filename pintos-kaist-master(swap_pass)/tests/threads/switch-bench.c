@@ -0,0 +1,52 @@
+/* Two threads of equal priority hand a semaphore back and forth
+   many times, so that nearly all the time goes to context
+   switches.  Reports the number of timer ticks taken; compare the
+   figure between kernels. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define ROUND_TRIPS 100000
+
+static thread_func pong_thread;
+static struct semaphore ping, pong;
+
+void
+test_switch_bench (void) 
+{
+  int64_t start;
+  int i;
+
+  /* The handoff relies on strict priority scheduling. */
+  ASSERT (!thread_mlfqs);
+
+  sema_init (&ping, 0);
+  sema_init (&pong, 0);
+  thread_create ("pong", thread_get_priority (), pong_thread, NULL);
+
+  start = timer_ticks ();
+  for (i = 0; i < ROUND_TRIPS; i++) 
+    {
+      sema_up (&ping);
+      sema_down (&pong);
+    }
+  msg ("%d round trips in %"PRId64" ticks.",
+       ROUND_TRIPS, timer_elapsed (start));
+}
+
+static void
+pong_thread (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ROUND_TRIPS; i++) 
+    {
+      sema_down (&ping);
+      sema_up (&pong);
+    }
+}
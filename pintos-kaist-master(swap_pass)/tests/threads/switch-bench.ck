@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+fail "missing round-trip report\n"
+  if !grep (/^\(switch-bench\) 100000 round trips in \d+ ticks\.$/, @output);
+pass;
@@ -0,0 +1,27 @@
+/* Forks and waits for many short-lived children in a row, to
+   measure the cost of creating and destroying processes.  Compare
+   the "Timer: N ticks" line printed at shutdown between kernels. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 100
+
+void
+test_main (void) 
+{
+  int i;
+
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      int pid = fork ("child");
+      if (pid == 0)
+        exit (i);
+      if (pid < 0)
+        fail ("fork #%d failed", i);
+      if (wait (pid) != i)
+        fail ("wrong exit status for child #%d", i);
+    }
+  msg ("forked and reaped %d children", CHILD_CNT);
+}
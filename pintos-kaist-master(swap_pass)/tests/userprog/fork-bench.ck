@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($expected) = "(fork-bench) begin\n";
+$expected .= "child: exit($_)\n" foreach 0..99;
+$expected .= <<'EOF';
+(fork-bench) forked and reaped 100 children
+(fork-bench) end
+fork-bench: exit(0)
+EOF
+check_expected ([$expected]);
+pass;
@@ -0,0 +1,42 @@
+/* Fills a zeroed 4 MB bss buffer, which holds at least one 2 MB
+   aligned region that may be mapped with a single 2 MB page, then
+   writes a 16 MB buffer to evict it and checks that every page of
+   the first buffer kept its contents.  Evicting pages one at a time
+   splits the 2 MB mapping.
+   For this test, Pintos memory size is 20MB. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define ONE_MB (1 << 20)
+#define HUGE_SIZE (4 * ONE_MB)
+#define EVICT_SIZE (16 * ONE_MB)
+
+static char huge[HUGE_SIZE];
+static char evict[EVICT_SIZE];
+
+void
+test_main (void)
+{
+  size_t i;
+
+  msg ("read pass");
+  for (i = 0; i < HUGE_SIZE; i++)
+    if (huge[i] != 0)
+      fail ("byte %zu != 0", i);
+
+  msg ("write pass");
+  for (i = 0; i < HUGE_SIZE; i += PAGE_SIZE)
+    huge[i] = (char) (i / PAGE_SIZE);
+
+  msg ("evict");
+  for (i = 0; i < EVICT_SIZE; i += PAGE_SIZE)
+    evict[i] = 1;
+
+  msg ("check pass");
+  for (i = 0; i < HUGE_SIZE; i++)
+    if (huge[i] != (i % PAGE_SIZE == 0 ? (char) (i / PAGE_SIZE) : 0))
+      fail ("byte %zu is wrong", i);
+}
@@ -15,11 +15,13 @@
 #include "devices/vga.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/kmem.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/mmu.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -85,6 +87,7 @@ main (void) {
 	/* Initialize memory system. */
 	mem_end = palloc_init ();
 	malloc_init ();
+	kmem_init ();
 	paging_init (mem_end);
 
 #ifdef USERPROG
@@ -152,9 +155,20 @@ paging_init (uint64_t mem_end) {
 	extern char start, _end_kernel_text;
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
+	// Whole 2 MB regions get a single PDE each, except the ones the
+	// read-only kernel text lies in.
 	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
 		uint64_t va = (uint64_t) ptov(pa);
 
+		if (pa % HPGSIZE == 0 && pa + HPGSIZE <= mem_end
+				&& (va + HPGSIZE <= (uint64_t) &start
+					|| (uint64_t) &_end_kernel_text <= va)) {
+			if ((pte = pml4_pde_walk (pml4, va, 1)) != NULL)
+				*pte = pa | PTE_P | PTE_W | PTE_PS;
+			pa += HPGSIZE - PGSIZE;
+			continue;
+		}
+
 		perm = PTE_P | PTE_W;
 		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
 			perm &= ~PTE_W;
@@ -221,15 +235,33 @@ parse_options (char **argv) {
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-cfs"))
+			thread_cfs = true;
+		else if (!strcmp (name, "-cfs-gran"))
+			thread_cfs_granularity = atoi (value);
+		else if (!strcmp (name, "-tickless"))
+			timer_tickless = true;
+		else if (!strcmp (name, "-lockstat"))
+			lock_profiling = true;
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-swap-low"))
+			vm_free_low = atoi (value);
+		else if (!strcmp (name, "-swap-high"))
+			vm_free_high = atoi (value);
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
 	}
+	if (thread_mlfqs && thread_cfs)
+		PANIC ("-mlfqs and -cfs are mutually exclusive");
+	if (thread_cfs_granularity < 1)
+		PANIC ("-cfs-gran must be at least 1 tick");
 
 	return argv;
 }
@@ -326,8 +358,16 @@ usage (void) {
 			"  -f                 Format file system disk during startup.\n"
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -cfs               Use fair-share scheduler.\n"
+			"  -cfs-gran=TICKS    Let a thread run TICKS before fair-share preemption.\n"
+			"  -tickless          Stop the timer tick while the CPU is idle.\n"
+			"  -lockstat          Print lock contention statistics at shutdown.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -swap-low=COUNT    Start paging out below COUNT free frames.\n"
+			"  -swap-high=COUNT   Stop paging out at COUNT free frames.\n"
 #endif
 			);
 	power_off ();
@@ -354,6 +394,9 @@ static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	lock_print_stats ();
+	palloc_print_stats ();
+	kmem_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
 #endif
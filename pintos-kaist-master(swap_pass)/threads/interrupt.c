@@ -344,6 +344,12 @@ intr_handler (struct intr_frame *frame) {
 
 		in_external_intr = true;
 		yield_on_return = false;
+
+		/* Any interrupt ends an idle halt.  Close the one-shot
+		   countdown now, before the handler can wake a thread that
+		   runs next, so that only the ticks that passed while idle
+		   are counted as idle and the periodic tick is back. */
+		timer_idle_exit ();
 	}
 
 	/* Invoke the interrupt's handler. */
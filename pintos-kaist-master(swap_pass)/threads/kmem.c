@@ -0,0 +1,215 @@
+#include "threads/kmem.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Object caches.
+
+   A cache hands out objects of a single size, carved out of
+   page-sized "slabs".  Each slab starts with a struct slab and
+   keeps its free objects on a singly linked list.  A cache keeps
+   the slabs that have free objects on its PARTIAL list; a slab
+   that runs out of free objects leaves the list, and one whose
+   objects are all free again goes back to the page allocator.
+
+   Compared with malloc(), objects are not rounded up to a power
+   of 2, and every type has its own lock.
+
+   If a cache has a constructor, it runs once for each object,
+   when the slab is created, and the caller must return objects
+   to the cache in their constructed state.  The free list link is
+   then kept past the end of each object so that it does not
+   overwrite the object. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Slab header. */
+struct slab {
+	unsigned magic;             /* Always set to SLAB_MAGIC. */
+	struct kmem_cache *cache;   /* Owning cache. */
+	struct list_elem elem;      /* Element in cache's PARTIAL list. */
+	size_t free_cnt;            /* Number of free objects. */
+	void *free;                 /* First free object. */
+};
+
+/* All caches, for kmem_print_stats(). */
+static struct list caches;
+
+static struct slab *obj_to_slab (struct kmem_cache *, void *obj);
+
+/* Returns the free list link of free object OBJ in cache C. */
+static inline void **
+free_link (struct kmem_cache *c, void *obj) {
+	return (void **) ((uint8_t *) obj + (c->ctor != NULL ? c->obj_size : 0));
+}
+
+/* Initializes the object cache module. */
+void
+kmem_init (void) {
+	list_init (&caches);
+}
+
+/* Initializes C as a cache of SIZE-byte objects named NAME.  If
+   CTOR is nonnull, it is called on every object of a new slab. */
+void
+kmem_cache_init (struct kmem_cache *c, const char *name, size_t size,
+		kmem_ctor_func *ctor) {
+	enum intr_level old_level;
+
+	ASSERT (c != NULL);
+	ASSERT (size > 0);
+
+	c->name = name;
+	c->obj_size = ROUND_UP (size, sizeof (void *));
+	c->stride = c->obj_size + (ctor != NULL ? sizeof (void *) : 0);
+	c->objs_per_slab = (PGSIZE - sizeof (struct slab)) / c->stride;
+	ASSERT (c->objs_per_slab > 0);
+	c->ctor = ctor;
+	lock_init (&c->lock);
+	lock_set_name (&c->lock, name);
+	list_init (&c->partial);
+	c->slab_cnt = c->in_use = c->peak = 0;
+
+	old_level = intr_disable ();
+	list_push_back (&caches, &c->elem);
+	intr_set_level (old_level);
+}
+
+/* Obtains a page from the page allocator and sets it up as a slab
+   of cache C.  Returns a null pointer if memory is not available. */
+static struct slab *
+slab_create (struct kmem_cache *c) {
+	struct slab *s = palloc_get_page (0);
+	uint8_t *obj;
+	size_t i;
+
+	if (s == NULL)
+		return NULL;
+	s->magic = SLAB_MAGIC;
+	s->cache = c;
+	s->free_cnt = c->objs_per_slab;
+	s->free = NULL;
+	obj = (uint8_t *) (s + 1) + c->stride * c->objs_per_slab;
+	for (i = 0; i < c->objs_per_slab; i++) {
+		obj -= c->stride;
+		if (c->ctor != NULL)
+			c->ctor (obj);
+		*free_link (c, obj) = s->free;
+		s->free = obj;
+	}
+	c->slab_cnt++;
+	return s;
+}
+
+/* Obtains and returns an object from cache C.  Returns a null
+   pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) {
+	struct slab *s;
+	void *obj;
+
+	ASSERT (c != NULL);
+
+	lock_acquire (&c->lock);
+	if (list_empty (&c->partial)) {
+		s = slab_create (c);
+		if (s == NULL) {
+			lock_release (&c->lock);
+			return NULL;
+		}
+		list_push_front (&c->partial, &s->elem);
+	} else
+		s = list_entry (list_front (&c->partial), struct slab, elem);
+
+	obj = s->free;
+	s->free = *free_link (c, obj);
+	if (--s->free_cnt == 0)
+		list_remove (&s->elem);
+	if (++c->in_use > c->peak)
+		c->peak = c->in_use;
+	lock_release (&c->lock);
+	return obj;
+}
+
+/* Obtains an object from cache C, which must not have a
+   constructor, and fills it with zeros.  Returns a null pointer if
+   memory is not available. */
+void *
+kmem_cache_zalloc (struct kmem_cache *c) {
+	void *obj;
+
+	ASSERT (c->ctor == NULL);
+
+	obj = kmem_cache_alloc (c);
+	if (obj != NULL)
+		memset (obj, 0, c->obj_size);
+	return obj;
+}
+
+/* Returns OBJ, which must have come from cache C, to C.  Does
+   nothing if OBJ is null. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) {
+	struct slab *s;
+
+	if (obj == NULL)
+		return;
+	s = obj_to_slab (c, obj);
+
+#ifndef NDEBUG
+	/* Clear the object to help detect use-after-free bugs. */
+	if (c->ctor == NULL)
+		memset (obj, 0xcc, c->obj_size);
+#endif
+
+	lock_acquire (&c->lock);
+	*free_link (c, obj) = s->free;
+	s->free = obj;
+	c->in_use--;
+	if (s->free_cnt++ == 0)
+		list_push_front (&c->partial, &s->elem);
+	if (s->free_cnt == c->objs_per_slab) {
+		/* The slab is entirely unused, so free it. */
+		list_remove (&s->elem);
+		s->magic = 0;
+		palloc_free_page (s);
+		c->slab_cnt--;
+	}
+	lock_release (&c->lock);
+}
+
+/* Returns the slab of cache C that OBJ is inside. */
+static struct slab *
+obj_to_slab (struct kmem_cache *c, void *obj) {
+	struct slab *s = pg_round_down (obj);
+
+	/* Check that the slab is valid. */
+	ASSERT (s->magic == SLAB_MAGIC);
+	ASSERT (s->cache == c);
+
+	/* Check that the object is properly aligned for the slab. */
+	ASSERT (((uint8_t *) obj - (uint8_t *) (s + 1)) % c->stride == 0);
+
+	return s;
+}
+
+/* Prints usage statistics for every cache. */
+void
+kmem_print_stats (void) {
+	struct list_elem *e;
+
+	for (e = list_begin (&caches); e != list_end (&caches); e = list_next (e)) {
+		struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+
+		printf ("Slab %s: %zu objects in use (peak %zu), %zu slabs, "
+				"%zu bytes x %zu per slab\n",
+				c->name, c->in_use, c->peak, c->slab_cnt,
+				c->obj_size, c->objs_per_slab);
+	}
+}
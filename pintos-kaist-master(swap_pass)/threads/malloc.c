@@ -68,6 +68,7 @@ static struct block *arena_to_block (struct arena *, size_t idx);
 void
 malloc_init (void) {
 	size_t block_size;
+	char name[16];
 
 	for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2) {
 		struct desc *d = &descs[desc_cnt++];
@@ -76,6 +77,8 @@ malloc_init (void) {
 		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
 		list_init (&d->free_list);
 		lock_init (&d->lock);
+		snprintf (name, sizeof name, "malloc %zu", block_size);
+		lock_set_name (&d->lock, name);
 	}
 }
 
@@ -1,13 +1,59 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
+#include <debug.h>
 #include "threads/init.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/interrupt.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Page tables set aside by pml4_set_huge_page, one for each user
+ * 2 MB page not split yet, so that splitting never runs out of
+ * memory.  Linked through their first word. */
+static void *split_reserve;
+
+static void
+split_reserve_push (void *pt) {
+	enum intr_level old_level = intr_disable ();
+	*(void **) pt = split_reserve;
+	split_reserve = pt;
+	intr_set_level (old_level);
+}
+
+static void *
+split_reserve_pop (void) {
+	enum intr_level old_level = intr_disable ();
+	void *pt = split_reserve;
+	ASSERT (pt != NULL);
+	split_reserve = *(void **) pt;
+	intr_set_level (old_level);
+	return pt;
+}
+
+/* Replaces the user 2 MB page that PDE maps at VA by a page table of
+ * 4 kB pages with the same flags, accessed and dirty bits, taken from
+ * split_reserve. */
+static void
+split_huge_pde (uint64_t *pde, const uint64_t va) {
+	uint64_t *pt = split_reserve_pop ();
+	uint64_t pa = PTE_ADDR (*pde);
+	uint64_t flags = *pde & PTE_FLAGS & ~PTE_PS;
+
+	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+		pt[i] = (pa + i * PGSIZE) | flags;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+
+	/* Otherwise the CPU keeps using, and setting the dirty bit in,
+	 * a cached translation of the old PDE. */
+	invlpg (va);
+}
+
+/* A 2 MB page is returned as its PDE unless CREATE, which asks for
+ * a 4 kB PTE and so splits a user 2 MB page.  The kernel's direct map
+ * is never split, so CREATE fails there. */
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
@@ -22,6 +68,12 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 					return NULL;
 			} else
 				return NULL;
+		} else if (pdp[idx] & PTE_PS) {
+			if (!create)
+				return &pdp[idx];
+			if (!is_user_vaddr ((void *) va))
+				return NULL;
+			split_huge_pde (&pdp[idx], va);
 		}
 		return (uint64_t *) ptov (PTE_ADDR (pdp[idx]) + 8 * PTX (va));
 	}
@@ -60,7 +112,9 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
  * If PML4E does not have a page table for VADDR, behavior depends
  * on CREATE.  If CREATE is true, then a new page table is
  * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
+ * pointer is returned.
+ * If VADDR lies in a 2 MB page, its PDE is returned, or with
+ * CREATE a user 2 MB page is split into 4 kB pages first. */
 uint64_t *
 pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	uint64_t *pte = NULL;
@@ -88,6 +142,40 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the address of the page directory entry for virtual
+ * address VA in PML4, creating the tables above it if CREATE.
+ * Returns a null pointer if they are missing or memory allocation
+ * fails, which may leave new, empty tables behind. */
+uint64_t *
+pml4_pde_walk (uint64_t *pml4, const uint64_t va, int create) {
+	uint64_t *table = pml4;
+	const unsigned idx[] = { PML4 (va), PDPE (va) };
+
+	for (unsigned i = 0; i < sizeof idx / sizeof *idx; i++) {
+		uint64_t *e = &table[idx[i]];
+		if (!(*e & PTE_P)) {
+			if (!create)
+				return NULL;
+			uint64_t *new_page = palloc_get_page (PAL_ZERO);
+			if (new_page == NULL)
+				return NULL;
+			*e = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+		}
+		table = ptov (PTE_ADDR (*e));
+	}
+	return &table[PDX (va)];
+}
+
+/* Returns the 4 kB PTE for VA in PML4, splitting the user 2 MB page
+ * VA lies in, if any.  Returns a null pointer if VA is not mapped. */
+static uint64_t *
+pte_walk_split (uint64_t *pml4, const uint64_t va) {
+	uint64_t *pte = pml4e_walk (pml4, va, false);
+	if (pte != NULL && (*pte & PTE_PS))
+		pte = pml4e_walk (pml4, va, true);
+	return pte;
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -96,7 +184,7 @@ uint64_t *
 pml4_create (void) {
 	uint64_t *pml4 = palloc_get_page (0);
 	if (pml4)
-		memcpy (pml4, base_pml4, PGSIZE);
+		copy_page (pml4, base_pml4);
 	return pml4;
 }
 
@@ -122,10 +210,17 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
-					pml4_index, pdp_index, i))
+		if (!(((uint64_t) pte) & PTE_P))
+			continue;
+		if (pdp[i] & PTE_PS) {
+			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+								 ((uint64_t) pdp_index << PDPESHIFT) |
+								 ((uint64_t) i << PDXSHIFT));
+			if (!func (&pdp[i], va, aux))
 				return false;
+		} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
+					pml4_index, pdp_index, i))
+			return false;
 	}
 	return true;
 }
@@ -165,11 +260,17 @@ pt_destroy (uint64_t *pt) {
 	palloc_free_page ((void *) pt);
 }
 
+/* The frames of a 2 MB page are freed by the VM; only the page
+ * table reserved for splitting it goes with it. */
 static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		if (!(((uint64_t) pte) & PTE_P))
+			continue;
+		if (pdp[i] & PTE_PS)
+			palloc_free_page (split_reserve_pop ());
+		else
 			pt_destroy (PTE_ADDR (pte));
 	}
 	palloc_free_page ((void *) pdp);
@@ -216,8 +317,11 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
-	if (pte && (*pte & PTE_P))
+	if (pte && (*pte & PTE_P)) {
+		if (*pte & PTE_PS)
+			return ptov (PTE_ADDR (*pte)) + ((uint64_t) uaddr & (HPGSIZE - 1));
 		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+	}
 	return NULL;
 }
 
@@ -243,6 +347,36 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 	return pte != NULL;
 }
 
+/* Maps the 2 MB-aligned user virtual region at UPAGE to the
+ * physically contiguous, 2 MB-aligned frames at KPAGE with a single
+ * PDE.  Changing the mapping of one 4 kB page later splits it, into a
+ * page table set aside here.  Returns false if part of the region
+ * already has a page table or memory allocation fails. */
+bool
+pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	ASSERT ((uint64_t) upage % HPGSIZE == 0);
+	ASSERT (vtop (kpage) % HPGSIZE == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	uint64_t *pde = pml4_pde_walk (pml4, (uint64_t) upage, 1);
+	if (pde == NULL || (*pde & PTE_P))
+		return false;
+	void *pt = palloc_get_page (0);
+	if (pt == NULL)
+		return false;
+	split_reserve_push (pt);
+	*pde = vtop (kpage) | PTE_P | PTE_PS | (rw ? PTE_W : 0) | PTE_U;
+	return true;
+}
+
+/* Returns true if VPAGE is part of a 2 MB page in PML4. */
+bool
+pml4_is_huge_page (uint64_t *pml4, const void *vpage) {
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	return pte != NULL && (*pte & PTE_PS) != 0;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
@@ -253,7 +387,7 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (is_user_vaddr (upage));
 
-	pte = pml4e_walk (pml4, (uint64_t) upage, false);
+	pte = pte_walk_split (pml4, (uint64_t) upage);
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
@@ -262,9 +396,21 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 	}
 }
 
+/* Makes virtual page VPAGE read-only in PML4, if it is mapped, so
+ * that the next write to it faults. */
+void
+pml4_clear_writable (uint64_t *pml4, const void *vpage) {
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	if (pte != NULL && (*pte & PTE_W)) {
+		*pte &= ~PTE_W;
+		if (rcr3 () == vtop (pml4))
+			invlpg ((uint64_t) vpage);
+	}
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
  * that is, if the page has been modified since the PTE was
- * installed.
+ * installed.  For a 2 MB page, any write to it counts.
  * Returns false if PML4 contains no PTE for VPAGE. */
 bool
 pml4_is_dirty (uint64_t *pml4, const void *vpage) {
@@ -276,7 +422,7 @@ pml4_is_dirty (uint64_t *pml4, const void *vpage) {
  * in PML4. */
 void
 pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	uint64_t *pte = pte_walk_split (pml4, (uint64_t) vpage);
 	if (pte) {
 		if (dirty)
 			*pte |= PTE_D;
@@ -299,7 +445,7 @@ pml4_is_accessed (uint64_t *pml4, const void *vpage) {
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+   VPAGE in PD.  All pages of a 2 MB page share one bit. */
 void
 pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
@@ -313,3 +459,24 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 			invlpg ((uint64_t) vpage);
 	}
 }
+
+/* Copies the page at SRC to the page at DST.  Both must be
+ * page-aligned and must not overlap. */
+void
+copy_page (void *dst, const void *src) {
+	size_t cnt = PGSIZE / sizeof (uint64_t);
+
+	ASSERT (pg_ofs (dst) == 0 && pg_ofs (src) == 0);
+	asm volatile ("rep movsq"
+			: "+D" (dst), "+S" (src), "+c" (cnt) : : "memory");
+}
+
+/* Fills the page at PAGE, which must be page-aligned, with zeros. */
+void
+clear_page (void *page) {
+	size_t cnt = PGSIZE / sizeof (uint64_t);
+
+	ASSERT (pg_ofs (page) == 0);
+	asm volatile ("rep stosq"
+			: "+D" (page), "+c" (cnt) : "a" (0ULL) : "memory");
+}
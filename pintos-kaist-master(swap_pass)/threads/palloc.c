@@ -2,6 +2,7 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -9,6 +10,7 @@
 #include <string.h>
 #include "threads/init.h"
 #include "threads/loader.h"
+#include "threads/mmu.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -24,13 +26,44 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is a binary buddy allocator.  Free memory is kept as
+   blocks of 2**ORDER pages, aligned to their size in physical
+   memory, on one free list per order.  A request for N pages takes
+   the smallest block of at least N pages, splitting larger blocks
+   as needed, and gives back the pages past N; freeing merges a
+   block with its buddy for as long as the buddy is free too.  The
+   list elements and orders live in arrays beside the used map, so
+   free pages are never written to.
+
+   Each pool also keeps a small stash of pages that the idle thread
+   has already filled with zeros, so that single-page PAL_ZERO
+   requests, such as page tables, need not clear a page on the
+   caller's path.  Stashed pages count as allocated; when the free
+   lists cannot satisfy a request, the stash is given back first. */
+
+/* Number of block sizes: 1, 2, 4, ..., 2**(BUDDY_ORDERS - 1) pages. */
+#define BUDDY_ORDERS 20
+
+/* Order of a page that does not start a free block. */
+#define NOT_HEAD 0xff
+
+/* Pre-zeroed pages kept per pool. */
+#define ZEROED_MAX 64
 
 /* A memory pool. */
 struct pool {
-	struct lock lock;               /* Mutual exclusion. */
-	struct bitmap *used_map;        /* Bitmap of free pages. */
+	struct spinlock lock;           /* Mutual exclusion. */
+	struct bitmap *used_map;        /* Bitmap of allocated pages. */
 	uint8_t *base;                  /* Base of pool. */
+	const char *name;               /* For palloc_print_stats(). */
+	struct list_elem *links;        /* Per page: free list element. */
+	uint8_t *orders;                /* Per page: order or NOT_HEAD. */
+	struct list free[BUDDY_ORDERS]; /* Free blocks, by order. */
+	size_t free_cnt;                /* Number of free pages. */
+	void *zeroed[ZEROED_MAX];       /* Stash of zero-filled pages. */
+	size_t zeroed_cnt;              /* Number of pages in ZEROED. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -39,9 +72,13 @@ static struct pool kernel_pool, user_pool;
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
 static void
-init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
+init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end,
+		const char *name);
 
 static bool page_from_pool (const struct pool *, void *page);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void zeroed_flush (struct pool *);
 
 /* multiboot info */
 struct multiboot_info {
@@ -158,8 +195,8 @@ populate_pools (struct area *base_mem, struct area *ext_mem) {
 						break;
 					}
 					// generate kernel pool
-					init_pool (&kernel_pool,
-							&free_start, region_start, start + rem * PGSIZE);
+					init_pool (&kernel_pool, &free_start, region_start,
+							start + rem * PGSIZE, "kernel pool");
 					// Transition to the next state
 					if (rem == size_in_pg) {
 						rem = user_pages;
@@ -188,7 +225,7 @@ populate_pools (struct area *base_mem, struct area *ext_mem) {
 	}
 
 	// generate the user pool
-	init_pool(&user_pool, &free_start, region_start, end);
+	init_pool(&user_pool, &free_start, region_start, end, "user pool");
 
 	// Iterate over the e820_entry. Setup the usable.
 	uint64_t usable_bound = (uint64_t) free_start;
@@ -232,6 +269,25 @@ split:
 			}
 		}
 	}
+
+	/* Now that the map is complete, put the free pages on the free
+	   lists.  Going through the map copes with overlapping entries. */
+	for (pool = &kernel_pool; pool != NULL;
+			pool = pool == &kernel_pool ? &user_pool : NULL) {
+		size_t pool_pages = bitmap_size (pool->used_map);
+
+		page_idx = bitmap_scan (pool->used_map, 0, 1, false);
+		while (page_idx != BITMAP_ERROR) {
+			size_t run_end = bitmap_scan (pool->used_map, page_idx, 1, true);
+
+			if (run_end == BITMAP_ERROR)
+				run_end = pool_pages;
+			page_cnt = run_end - page_idx;
+			bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+			buddy_free (pool, page_idx, page_cnt);
+			page_idx = bitmap_scan (pool->used_map, run_end, 1, false);
+		}
+	}
 }
 
 /* Initializes the page allocator and get the memory size */
@@ -262,20 +318,28 @@ palloc_init (void) {
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	void *pages = NULL;
 
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
-	void *pages;
+	spin_lock (&pool->lock);
+	if (page_cnt == 1 && (flags & PAL_ZERO) && pool->zeroed_cnt > 0) {
+		pages = pool->zeroed[--pool->zeroed_cnt];
+		spin_unlock (&pool->lock);
+		return pages;
+	}
+	size_t page_idx = buddy_alloc (pool, page_cnt);
+	if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0) {
+		zeroed_flush (pool);
+		page_idx = buddy_alloc (pool, page_cnt);
+	}
+	spin_unlock (&pool->lock);
 
 	if (page_idx != BITMAP_ERROR)
 		pages = pool->base + PGSIZE * page_idx;
-	else
-		pages = NULL;
 
 	if (pages) {
 		if (flags & PAL_ZERO)
-			memset (pages, 0, PGSIZE * page_cnt);
+			for (size_t i = 0; i < page_cnt; i++)
+				clear_page ((uint8_t *) pages + PGSIZE * i);
 	} else {
 		if (flags & PAL_ASSERT)
 			PANIC ("palloc_get: out of pages");
@@ -318,8 +382,9 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
-	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	spin_lock (&pool->lock);
+	buddy_free (pool, page_idx, page_cnt);
+	spin_unlock (&pool->lock);
 }
 
 /* Frees the page at PAGE. */
@@ -330,19 +395,33 @@ palloc_free_page (void *page) {
 
 /* Initializes pool P as starting at START and ending at END */
 static void
-init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
+init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end,
+		const char *name) {
   /* We'll put the pool's used_map at its base.
      Calculate the space needed for the bitmap
      and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
-	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
-
-	lock_init(&p->lock);
-	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
+	size_t bm_size = bitmap_buf_size (pgcnt);
+	size_t links_size = pgcnt * sizeof *p->links;
+	size_t bm_pages = DIV_ROUND_UP (bm_size + links_size + pgcnt, PGSIZE)
+		* PGSIZE;
+	int order;
+
+	spinlock_init(&p->lock);
+	spinlock_set_name(&p->lock, name);
+	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_size);
+	p->links = (struct list_elem *) ((uint8_t *) *bm_base + bm_size);
+	p->orders = (uint8_t *) p->links + links_size;
 	p->base = (void *) start;
+	p->name = name;
+	p->free_cnt = 0;
+	p->zeroed_cnt = 0;
+	for (order = 0; order < BUDDY_ORDERS; order++)
+		list_init (&p->free[order]);
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
+	memset (p->orders, NOT_HEAD, pgcnt);
 
 	*bm_base += bm_pages;
 }
@@ -356,3 +435,183 @@ page_from_pool (const struct pool *pool, void *page) {
 	size_t end_page = start_page + bitmap_size (pool->used_map);
 	return page_no >= start_page && page_no < end_page;
 }
+
+/* Returns the physical page number of POOL's page PAGE_IDX.  Buddy
+   blocks are aligned on physical page numbers, so that a block of
+   512 pages is also a naturally aligned 2 MB region. */
+static size_t
+pool_pfn (const struct pool *pool, size_t page_idx) {
+	return pg_no (vtop (pool->base)) + page_idx;
+}
+
+/* Puts the free block of 2**ORDER pages at PAGE_IDX on POOL's
+   free list. */
+static void
+buddy_push (struct pool *pool, size_t page_idx, int order) {
+	pool->orders[page_idx] = order;
+	list_push_front (&pool->free[order], &pool->links[page_idx]);
+}
+
+/* Takes the free block at PAGE_IDX off POOL's free list. */
+static void
+buddy_remove (struct pool *pool, size_t page_idx) {
+	ASSERT (pool->orders[page_idx] != NOT_HEAD);
+
+	pool->orders[page_idx] = NOT_HEAD;
+	list_remove (&pool->links[page_idx]);
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX in POOL, merging
+   it with its buddy for as long as the buddy is free. */
+static void
+buddy_free_block (struct pool *pool, size_t page_idx, int order) {
+	size_t pool_pages = bitmap_size (pool->used_map);
+	size_t base_pfn = pool_pfn (pool, 0);
+
+	while (order < BUDDY_ORDERS - 1) {
+		size_t buddy_pfn = (base_pfn + page_idx) ^ ((size_t) 1 << order);
+		size_t buddy_idx = buddy_pfn - base_pfn;
+
+		if (buddy_pfn < base_pfn
+				|| buddy_idx + ((size_t) 1 << order) > pool_pages
+				|| pool->orders[buddy_idx] != order)
+			break;
+		buddy_remove (pool, buddy_idx);
+		if (buddy_idx < page_idx)
+			page_idx = buddy_idx;
+		order++;
+	}
+	buddy_push (pool, page_idx, order);
+}
+
+/* Frees the PAGE_CNT pages at PAGE_IDX in POOL, which need not
+   form a single block, by freeing the largest aligned blocks that
+   cover them.  The pages must be allocated. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+
+	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	pool->free_cnt += page_cnt;
+	while (page_cnt > 0) {
+		size_t pfn = pool_pfn (pool, page_idx);
+		int order = 0;
+
+		while (order < BUDDY_ORDERS - 1
+				&& pfn % ((size_t) 2 << order) == 0
+				&& ((size_t) 2 << order) <= page_cnt)
+			order++;
+		buddy_free_block (pool, page_idx, order);
+		page_idx += (size_t) 1 << order;
+		page_cnt -= (size_t) 1 << order;
+	}
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if no block is big enough. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt) {
+	size_t page_idx;
+	int want = 0, order;
+
+	if (page_cnt == 0)
+		return BITMAP_ERROR;
+	while (want < BUDDY_ORDERS && ((size_t) 1 << want) < page_cnt)
+		want++;
+	for (order = want; order < BUDDY_ORDERS; order++)
+		if (!list_empty (&pool->free[order]))
+			break;
+	if (order >= BUDDY_ORDERS)
+		return BITMAP_ERROR;
+
+	page_idx = list_front (&pool->free[order]) - pool->links;
+	buddy_remove (pool, page_idx);
+
+	/* Split down to the size wanted, freeing the upper halves. */
+	while (order > want) {
+		order--;
+		buddy_push (pool, page_idx + ((size_t) 1 << order), order);
+	}
+	pool->free_cnt -= (size_t) 1 << order;
+
+	/* Give back what is left over past PAGE_CNT. */
+	bitmap_set_multiple (pool->used_map, page_idx, (size_t) 1 << order, true);
+	if (page_cnt < ((size_t) 1 << order))
+		buddy_free (pool, page_idx + page_cnt,
+				((size_t) 1 << order) - page_cnt);
+	return page_idx;
+}
+
+/* Gives POOL's stashed zero pages back to the free lists.  The
+   pool's lock must be held. */
+static void
+zeroed_flush (struct pool *pool) {
+	while (pool->zeroed_cnt > 0) {
+		void *page = pool->zeroed[--pool->zeroed_cnt];
+		buddy_free (pool, pg_no (page) - pg_no (pool->base), 1);
+	}
+}
+
+/* Zero-fills one free page into POOL's stash, unless the stash is
+   full or no page is free.  Returns true if a page was added. */
+static bool
+zeroed_refill (struct pool *pool) {
+	size_t page_idx;
+	void *page;
+
+	spin_lock (&pool->lock);
+	page_idx = pool->zeroed_cnt < ZEROED_MAX
+		? buddy_alloc (pool, 1) : BITMAP_ERROR;
+	spin_unlock (&pool->lock);
+	if (page_idx == BITMAP_ERROR)
+		return false;
+
+	/* Clear the page without holding the lock, then stash it if
+	   there is still room. */
+	page = pool->base + PGSIZE * page_idx;
+	clear_page (page);
+	spin_lock (&pool->lock);
+	if (pool->zeroed_cnt < ZEROED_MAX)
+		pool->zeroed[pool->zeroed_cnt++] = page;
+	else
+		buddy_free (pool, page_idx, 1);
+	spin_unlock (&pool->lock);
+	return true;
+}
+
+/* Zero-fills one page for a pool whose stash is not full.  Called
+   by the idle thread, with interrupts on, until it returns false. */
+bool
+palloc_zero_idle (void) {
+	return zeroed_refill (&kernel_pool) || zeroed_refill (&user_pool);
+}
+
+/* Prints POOL's free memory by block size. */
+static void
+pool_print_stats (struct pool *pool) {
+	size_t largest = 0;
+	int order;
+
+	printf ("Palloc: %s: %zu of %zu pages free, %zu pre-zeroed, "
+			"blocks (count x pages):", pool->name, pool->free_cnt,
+			bitmap_size (pool->used_map), pool->zeroed_cnt);
+	for (order = 0; order < BUDDY_ORDERS; order++) {
+		size_t cnt = list_size (&pool->free[order]);
+
+		if (cnt > 0) {
+			printf (" %zux%zu", cnt, (size_t) 1 << order);
+			largest = cnt << order;
+		}
+	}
+	/* Share of free memory outside blocks of the largest size,
+	   that is, unusable for a request of that size. */
+	printf ("; %zu%% fragmented\n", pool->free_cnt > 0
+			? (pool->free_cnt - largest) * 100 / pool->free_cnt : 0);
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	pool_print_stats (&kernel_pool);
+	pool_print_stats (&user_pool);
+}
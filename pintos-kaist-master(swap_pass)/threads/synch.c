@@ -27,10 +27,30 @@
    */
 
 #include "threads/synch.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Arrival counter for waiters, so that equal priorities are
+   served in FIFO order. */
+static unsigned wait_seq;
+
+static heap_less_func waiter_less;
+static int lock_max_priority (const struct lock *);
+
+/* Kernel option -lockstat. */
+bool lock_profiling;
+
+/* Statistics for named locks, one entry per distinct name. */
+#define LOCK_STAT_CNT 32
+static struct lock_stat lock_stats[LOCK_STAT_CNT];
+static size_t lock_stat_cnt;
+
+static struct lock_stat *lock_stat_lookup (const char *name);
+static void lock_stat_acquired (struct lock_stat *, int64_t wait_start);
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -46,7 +66,31 @@ sema_init (struct semaphore *sema, unsigned value) {
 	ASSERT (sema != NULL);
 
 	sema->value = value;
-	list_init (&sema->waiters);
+	heap_init (&sema->waiters, waiter_less, NULL);
+	sema->stat = NULL;
+}
+
+/* Names SEMA for -lockstat, which then counts its downs and the
+   time spent waiting in them.  Does nothing without -lockstat. */
+void
+sema_set_name (struct semaphore *sema, const char *name) {
+	ASSERT (sema != NULL);
+	ASSERT (name != NULL);
+
+	sema->stat = lock_stat_lookup (name);
+}
+
+/* Orders threads waiting on a semaphore: higher priority first,
+   then first come, first served. */
+static bool
+waiter_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct thread *a = heap_entry (a_, struct thread, welem);
+	const struct thread *b = heap_entry (b_, struct thread, welem);
+
+	if (a->priority != b->priority)
+		return a->priority > b->priority;
+	return (int) (a->wait_seq - b->wait_seq) < 0;
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -60,16 +104,23 @@ sema_init (struct semaphore *sema, unsigned value) {
 void
 sema_down (struct semaphore *sema) {
 	enum intr_level old_level;
+	int64_t wait_start;
 
 	ASSERT (sema != NULL);
 	ASSERT (!intr_context ());
 
 	old_level = intr_disable ();
+	wait_start = sema->stat != NULL && sema->value == 0 ? timer_ticks () : -1;
 	while (sema->value == 0) {
-		list_insert_ordered(&sema->waiters,&thread_current ()->elem,thread_order,NULL);
+		struct thread *t = thread_current ();
+		t->wait_seq = wait_seq++;
+		t->wait_heap = &sema->waiters;
+		heap_push (&sema->waiters, &t->welem);
 		thread_block ();
 	}
 	sema->value--;
+	if (sema->stat != NULL)
+		lock_stat_acquired (sema->stat, wait_start);
 	intr_set_level (old_level);
 }
 
@@ -89,6 +140,8 @@ sema_try_down (struct semaphore *sema) {
 	if (sema->value > 0)
 	{
 		sema->value--;
+		if (sema->stat != NULL)
+			lock_stat_acquired (sema->stat, -1);
 		success = true;
 	}
 	else
@@ -109,10 +162,12 @@ sema_up (struct semaphore *sema) {
 	ASSERT (sema != NULL);
 
 	old_level = intr_disable ();
-	if (!list_empty (&sema->waiters)){
-		list_sort(&sema->waiters,thread_order,NULL);
-		thread_unblock (list_entry (list_pop_front (&sema->waiters),struct thread, elem));
-				}
+	if (!heap_empty (&sema->waiters)){
+		struct thread *t = heap_entry (heap_pop (&sema->waiters),
+				struct thread, welem);
+		t->wait_heap = NULL;
+		thread_unblock (t);
+	}
 	sema->value++;
 	test_max_priority();
 	intr_set_level (old_level);
@@ -176,6 +231,15 @@ lock_init (struct lock *lock) {
 	sema_init (&lock->semaphore, 1);
 }
 
+/* Names LOCK for -lockstat, which then also counts how long it is
+   held.  Locks given the same name share their statistics. */
+void
+lock_set_name (struct lock *lock, const char *name) {
+	ASSERT (lock != NULL);
+
+	sema_set_name (&lock->semaphore, name);
+}
+
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
@@ -193,13 +257,17 @@ lock_acquire (struct lock *lock) {
    if(lock->holder!=NULL){
       if(!thread_mlfqs){
       t->wait = lock;
-      list_insert_ordered(&lock->holder->donates,&t->delem,thread_order,NULL);
          donate();
       }
    }
 	sema_down (&lock->semaphore);
    t->wait = NULL;
+	if (lock->semaphore.stat != NULL)
+		lock->acquired_at = timer_ticks ();
 	lock->holder = thread_current ();
+	list_push_back (&t->held_locks, &lock->elem);
+   if(!thread_mlfqs)
+      refresh();
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -216,8 +284,12 @@ lock_try_acquire (struct lock *lock) {
 	ASSERT (!lock_held_by_current_thread (lock));
 
 	success = sema_try_down (&lock->semaphore);
-	if (success)
+	if (success) {
+		if (lock->semaphore.stat != NULL)
+			lock->acquired_at = timer_ticks ();
 		lock->holder = thread_current ();
+		list_push_back (&lock->holder->held_locks, &lock->elem);
+	}
 	return success;
 }
 
@@ -232,11 +304,15 @@ lock_release (struct lock *lock) {
 	ASSERT (lock != NULL);
 	ASSERT (lock_held_by_current_thread (lock));
 
+	if (lock->semaphore.stat != NULL) {
+		enum intr_level old_level = intr_disable ();
+		lock->semaphore.stat->hold_ticks += timer_elapsed (lock->acquired_at);
+		intr_set_level (old_level);
+	}
    lock->holder = NULL;
-   if(!thread_mlfqs){
-   release_d(lock);   
-   refresh();
-}
+   list_remove (&lock->elem);
+   if(!thread_mlfqs)
+      refresh();
 	sema_up (&lock->semaphore);
 }
 
@@ -250,12 +326,140 @@ lock_held_by_current_thread (const struct lock *lock) {
 	return lock->holder == thread_current ();
 }
 
-/* One semaphore in a list. */
+/* Initializes spinlock SL as released. */
+void
+spinlock_init (struct spinlock *sl) {
+	ASSERT (sl != NULL);
+
+	sl->locked = 0;
+	sl->stat = NULL;
+}
+
+/* Names SL for -lockstat.  Spinning happens with interrupts off,
+   so only acquisitions and contended acquisitions are counted. */
+void
+spinlock_set_name (struct spinlock *sl, const char *name) {
+	ASSERT (sl != NULL);
+
+	sl->stat = lock_stat_lookup (name);
+}
+
+/* Disables interrupts and acquires SL, spinning while another
+   processor holds it.  Must not be held across anything that
+   sleeps. */
+void
+spin_lock (struct spinlock *sl) {
+	enum intr_level old_level = intr_disable ();
+	bool contended = false;
+
+	while (__atomic_exchange_n (&sl->locked, 1, __ATOMIC_ACQUIRE)) {
+		contended = true;
+		while (sl->locked)
+			asm volatile ("pause");
+	}
+	sl->old_level = old_level;
+	if (sl->stat != NULL) {
+		sl->stat->acquired++;
+		if (contended)
+			sl->stat->contended++;
+	}
+}
+
+/* Releases SL and restores the interrupt level from before
+   spin_lock(). */
+void
+spin_unlock (struct spinlock *sl) {
+	enum intr_level old_level = sl->old_level;
+
+	ASSERT (sl->locked);
+	__atomic_store_n (&sl->locked, 0, __ATOMIC_RELEASE);
+	intr_set_level (old_level);
+}
+
+/* Returns the statistics entry for NAME, creating it if needed.
+   Returns a null pointer without -lockstat or if the table is
+   full. */
+static struct lock_stat *
+lock_stat_lookup (const char *name) {
+	struct lock_stat *st = NULL;
+	char key[sizeof st->name];
+	enum intr_level old_level;
+	size_t i;
+
+	if (!lock_profiling)
+		return NULL;
+
+	/* Compare as stored, that is, truncated. */
+	strlcpy (key, name, sizeof key);
+	old_level = intr_disable ();
+	for (i = 0; i < lock_stat_cnt && st == NULL; i++)
+		if (!strcmp (lock_stats[i].name, key))
+			st = &lock_stats[i];
+	if (st == NULL && lock_stat_cnt < LOCK_STAT_CNT) {
+		st = &lock_stats[lock_stat_cnt++];
+		strlcpy (st->name, key, sizeof st->name);
+	}
+	intr_set_level (old_level);
+	return st;
+}
+
+/* Records one acquisition against ST.  WAIT_START is when the
+   caller began to wait, or -1 if it did not have to.  Interrupts
+   must be off. */
+static void
+lock_stat_acquired (struct lock_stat *st, int64_t wait_start) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	st->acquired++;
+	if (wait_start >= 0) {
+		int64_t wait = timer_elapsed (wait_start);
+
+		st->contended++;
+		st->wait_ticks += wait;
+		if (wait > st->max_wait)
+			st->max_wait = wait;
+	}
+}
+
+/* Prints the statistics of every named lock, with -lockstat. */
+void
+lock_print_stats (void) {
+	size_t i;
+
+	if (!lock_profiling)
+		return;
+	for (i = 0; i < lock_stat_cnt; i++) {
+		const struct lock_stat *st = &lock_stats[i];
+
+		printf ("Lock %s: %u acquired, %u contended, %"PRId64" ticks waiting "
+				"(max %"PRId64"), %"PRId64" ticks held\n",
+				st->name, st->acquired, st->contended,
+				st->wait_ticks, st->max_wait, st->hold_ticks);
+	}
+}
+
+/* One semaphore in a condition variable's waiters. */
 struct semaphore_elem {
-	struct list_elem elem;              /* List element. */
+	struct heap_elem elem;              /* Heap element. */
 	struct semaphore semaphore;         /* This semaphore. */
+	struct thread *thread;              /* Waiting thread. */
+	unsigned seq;                       /* Order of arrival. */
 };
 
+/* Orders condition variable waiters like waiter_less(), by the
+   current priority of the waiting threads, which
+   thread_set_effective_priority() keeps the heap up to date with. */
+static bool
+cond_waiter_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct semaphore_elem *a = heap_entry (a_, struct semaphore_elem, elem);
+	const struct semaphore_elem *b = heap_entry (b_, struct semaphore_elem, elem);
+
+	if (a->thread->priority != b->thread->priority)
+		return a->thread->priority > b->thread->priority;
+	return (int) (a->seq - b->seq) < 0;
+}
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -263,7 +467,7 @@ void
 cond_init (struct condition *cond) {
 	ASSERT (cond != NULL);
 
-	list_init (&cond->waiters);
+	heap_init (&cond->waiters, cond_waiter_less, NULL);
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -289,6 +493,7 @@ cond_init (struct condition *cond) {
 void
 cond_wait (struct condition *cond, struct lock *lock) {
 	struct semaphore_elem waiter;
+	enum intr_level old_level;
 
 	ASSERT (cond != NULL);
 	ASSERT (lock != NULL);
@@ -296,7 +501,14 @@ cond_wait (struct condition *cond, struct lock *lock) {
 	ASSERT (lock_held_by_current_thread (lock));
 
 	sema_init (&waiter.semaphore, 0);
-	list_insert_ordered(&cond->waiters,&waiter.elem,sepm,NULL);
+	waiter.thread = thread_current ();
+	waiter.seq = wait_seq++;
+	/* Priorities change from interrupt handlers too. */
+	old_level = intr_disable ();
+	heap_push (&cond->waiters, &waiter.elem);
+	waiter.thread->cond_heap = &cond->waiters;
+	waiter.thread->cond_elem = &waiter.elem;
+	intr_set_level (old_level);
 	lock_release (lock);
 	sema_down (&waiter.semaphore);
 	lock_acquire (lock);
@@ -316,10 +528,14 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED) {
 	ASSERT (!intr_context ());
 	ASSERT (lock_held_by_current_thread (lock));
 
-	if (!list_empty (&cond->waiters)){
-		list_sort(&cond->waiters,sepm,NULL);
-		sema_up (&list_entry (list_pop_front (&cond->waiters),
-					struct semaphore_elem, elem)->semaphore);}
+	enum intr_level old_level = intr_disable ();
+	if (!heap_empty (&cond->waiters)) {
+		struct semaphore_elem *waiter = heap_entry (heap_pop (&cond->waiters),
+				struct semaphore_elem, elem);
+		waiter->thread->cond_heap = NULL;
+		sema_up (&waiter->semaphore);
+	}
+	intr_set_level (old_level);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -333,30 +549,9 @@ cond_broadcast (struct condition *cond, struct lock *lock) {
 	ASSERT (cond != NULL);
 	ASSERT (lock != NULL);
 
-	while (!list_empty (&cond->waiters))
+	while (!heap_empty (&cond->waiters))
 		cond_signal (cond, lock);
 }
-bool sepm(const struct list_elem *a,const struct list_elem *b,void *aux UNUSED) {
-  	struct semaphore_elem *sema_a = list_entry(a, struct semaphore_elem, elem);
-    struct semaphore_elem *sema_b = list_entry(b, struct semaphore_elem, elem);
-
-    if (sema_a == NULL || sema_b == NULL)
-        return false;
-
-    struct list *list_a = &(sema_a->semaphore.waiters);
-    struct list *list_b = &(sema_b->semaphore.waiters);
-
-    if (list_a == NULL || list_b == NULL)
-        return false;
-
-    struct thread *thread_a = list_entry(list_begin(list_a), struct thread, elem);
-    struct thread *thread_b = list_entry(list_begin(list_b), struct thread, elem);
-
-    if (thread_a == NULL || thread_b == NULL)
-        return false;
-
-    return thread_a->priority > thread_b->priority;
-}
 void donate(){
    struct thread *t = thread_current();
    struct lock *lck = t->wait;
@@ -366,34 +561,36 @@ void donate(){
       if (holder == NULL) 
          break;
       if(t->priority>holder->priority){
-         holder->priority =t->priority;
+         thread_set_effective_priority (holder, t->priority);
       }
       t = holder;
       lck = t->wait;
       depth++;
    }
 }
+/* Recomputes the running thread's priority as the highest of its
+   own and that of the top waiter of each lock it holds, in time
+   proportional to the number of locks held. */
 void refresh(){
    struct thread *t = thread_current();
-   t->priority = t->opriority;
-   if(!list_empty(&t->donates)){
-      list_sort(&t->donates,thread_order,NULL);
-      struct thread *tx = list_entry(list_front(&t->donates), struct thread, delem);
-      if(t->priority < tx->priority){
-         t->priority = tx->priority;
-      }
+   int priority = t->opriority;
+   struct list_elem *e;
+   for (e = list_begin (&t->held_locks); e != list_end (&t->held_locks);
+         e = list_next (e)) {
+      struct lock *l = list_entry (e, struct lock, elem);
+      int top = lock_max_priority (l);
+      if (top > priority)
+         priority = top;
    }
+   thread_set_effective_priority (t, priority);
 }
-void release_d(struct lock *lock){
-   struct thread *t = thread_current();
-   struct list_elem *e = list_begin(&t->donates);
-
-    while (e != list_end(&t->donates)) {
-      struct thread *tx = list_entry(e, struct thread, delem);
-      if(tx->wait == lock){
-         e = list_remove(e);
-      }else{
-         e = list_next(e);
-      }
-   }
+
+/* Returns the highest priority among threads waiting for LOCK, or
+   PRI_MIN - 1 if there are none. */
+static int
+lock_max_priority (const struct lock *lock) {
+   const struct heap *w = &lock->semaphore.waiters;
+   if (heap_empty (w))
+      return PRI_MIN - 1;
+   return heap_entry (heap_top (w), struct thread, welem)->priority;
 }
@@ -8,10 +8,12 @@
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "threads/fixed_point.h"
 #include "intrinsic.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -24,11 +26,41 @@
    Do not modify this value. */
 #define THREAD_BASIC 0xd42df210
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running.  There is one FIFO queue
+   per priority; bit P of ready_mask is set iff ready_queues[P] is
+   nonempty, so the highest ready priority is found in O(1).
+   ready_lock protects the queues, ready_mask, ready_cnt and the
+   fair-share queue below.
+   Only one CPU is ever started: these queues and idle_thread are
+   shared, thread_current() reads the stack of the one CPU, and much
+   of the kernel still relies on intr_disable() for mutual exclusion.
+   ready_lock alone does not make the scheduler multiprocessor-safe. */
 static struct list all_list;
-static struct list ready_list;
-static struct list sleeplist;
+static struct spinlock ready_lock;
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_mask;
+static size_t ready_cnt;        /* # of ready threads. */
+
+/* Under the fair-share scheduler, ready threads are instead kept in
+   cfs_queue ordered by virtual runtime, which grows by CFS_NICE_0
+   per tick for a nice 0 thread, and faster for nicer threads in
+   proportion to cfs_weight[].  min_vruntime never decreases; it
+   places new and waking threads. */
+#define CFS_NICE_0 1024
+static struct heap cfs_queue;
+static int64_t min_vruntime;
+static const int cfs_weight[NICE_MAX - NICE_MIN + 1] = {
+	/* -20 */ 88761, 71755, 56483, 46273, 36291,
+	/* -15 */ 29154, 23254, 18705, 14949, 11916,
+	/* -10 */ 9548, 7620, 6100, 4904, 3906,
+	/*  -5 */ 3121, 2501, 1991, 1586, 1277,
+	/*   0 */ 1024, 820, 655, 526, 423,
+	/*   5 */ 335, 272, 215, 172, 137,
+	/*  10 */ 110, 87, 70, 56, 45,
+	/*  15 */ 36, 29, 23, 18, 15,
+	/*  20 */ 12,
+};
 /* Idle thread. */
 static struct thread *idle_thread;
 
@@ -40,6 +72,12 @@ static struct lock tid_lock;
 /* Thread destruction requests */
 static struct list destruction_req;
 
+/* Pages of dead threads kept for reuse by thread_create(), so that
+   most creations neither go to palloc nor zero a page. */
+#define THREAD_CACHE_MAX 16
+static struct list thread_cache;
+static size_t thread_cache_cnt;
+
 /* Statistics. */
 static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
@@ -53,7 +91,25 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
+
+/* If true, use the fair-share scheduler, which ignores priorities.
+   Controlled by kernel command-line option "-cfs". */
+bool thread_cfs;
+
+/* Ticks a thread runs before the fair-share scheduler may preempt
+   it.  Controlled by kernel command-line option "-cfs-gran". */
+int thread_cfs_granularity = TIME_SLICE;
 int load_avg;
+
+/* MLFQS recent_cpu decay.  The once-per-second decay is applied at
+   once only to ready threads, whose order it may change:
+   decay_coef[E % DECAY_HIST] remembers the coefficient of second E,
+   and every other thread catches up from its own decay_epoch when it
+   is next examined (see recal_recent()). */
+#define DECAY_HIST 64
+static int decay_coef[DECAY_HIST];
+static int64_t decay_epoch;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -62,6 +118,13 @@ static void init_thread (struct thread *, const char *name, int priority);
 static void do_schedule(int status);
 static void schedule (void);
 static tid_t allocate_tid (void);
+static struct thread *thread_page_get (void);
+static void thread_page_put (struct thread *);
+static void ready_push (struct thread *);
+static struct thread *ready_pop (void);
+static int ready_max_priority (void);
+static bool cfs_should_preempt (struct thread *, int64_t margin);
+static heap_less_func cfs_less;
 /* Returns true if T appears to point to a valid thread. */
 #define is_thread(t) ((t) != NULL && (t)->magic == THREAD_MAGIC)
 
@@ -119,9 +182,14 @@ thread_init (void) {
 
 	/* Init the globla thread context */
 	lock_init (&tid_lock);
-	list_init (&ready_list);
+	lock_set_name (&tid_lock, "tid_lock");
+	spinlock_init (&ready_lock);
+	spinlock_set_name (&ready_lock, "ready_lock");
+	for (int i = PRI_MIN; i <= PRI_MAX; i++)
+		list_init (&ready_queues[i]);
 	list_init (&destruction_req);
-	list_init(&sleeplist);
+	list_init (&thread_cache);
+	heap_init (&cfs_queue, cfs_less, NULL);
 	list_init(&all_list);
 	load_avg = 0;
 	/* Set up a thread structure for the running thread. */
@@ -163,11 +231,31 @@ thread_tick (void) {
 	else
 		kernel_ticks++;
 
+	if (thread_cfs) {
+		/* Charge the tick to T's virtual runtime, and preempt T once
+		   it has had its granularity and is no longer the most
+		   deserving thread. */
+		if (t != idle_thread)
+			t->vruntime += CFS_NICE_0 * CFS_NICE_0
+				/ cfs_weight[t->nice - NICE_MIN];
+		if (++thread_ticks >= (unsigned) thread_cfs_granularity
+				&& cfs_should_preempt (t, 0))
+			intr_yield_on_return ();
+		return;
+	}
+
 	/* Enforce preemption. */
 	if (++thread_ticks >= TIME_SLICE)
 		intr_yield_on_return ();
 }
 
+/* Counts a timer tick that passed while the CPU was idle and the
+   periodic tick was stopped. */
+void
+thread_account_idle (void) {
+	idle_ticks++;
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) {
@@ -194,13 +282,13 @@ tid_t
 thread_create (const char *name, int priority,
 		thread_func *function, void *aux) {
 	struct thread *t;
-	
+	struct switch_threads_frame *sf;
 	tid_t tid;
 
 	ASSERT (function != NULL);
 
 	/* Allocate thread. */
-	t = palloc_get_page (PAL_ZERO);
+	t = thread_page_get ();
 	if (t == NULL)
 		return TID_ERROR;
 
@@ -208,28 +296,29 @@ thread_create (const char *name, int priority,
 	init_thread (t, name, priority);
 	tid = t->tid = allocate_tid ();
 
-	/* Call the kernel_thread if it scheduled.
-	 * Note) rdi is 1st argument, and rsi is 2nd argument. */
-	t->tf.rip = (uintptr_t) kernel_thread;
-	t->tf.R.rdi = (uint64_t) function;
-	t->tf.R.rsi = (uint64_t) aux;
-	t->tf.ds = SEL_KDSEG;
-	t->tf.es = SEL_KDSEG;
-	t->tf.ss = SEL_KDSEG;
-	t->tf.cs = SEL_KCSEG;
-	t->tf.eflags = FLAG_IF;
+	/* Seed the top of the stack so that the first switch_threads()
+	 * into T returns to switch_entry(), which calls
+	 * kernel_thread (FUNCTION, AUX). */
+	sf = (struct switch_threads_frame *) ((uint8_t *) t + PGSIZE) - 1;
+	*sf = (struct switch_threads_frame) {
+		.rbx = (uint64_t) kernel_thread,
+		.r12 = (uint64_t) function,
+		.r13 = (uint64_t) aux,
+		.rip = switch_entry,
+	};
+	t->switch_rsp = (uint64_t) sf;
 	#ifdef USERPROG
-	t->fdt = palloc_get_page(PAL_ZERO);
+	/* The fd table is allocated on first open. */
+	t->fdt = NULL;
 	t->fdcnt = 3;
-	t->fdt[0] = NULL;
-	t->fdt[1] = NULL;
-	t->fdt[2] = NULL;
 	t->exit_s = 0;
 	list_push_back(&thread_current()->children,&t->ichild);
 	#endif
 	/* Add to run queue. */
 	thread_unblock (t);
-	if(thread_current()->priority<priority){
+	if(thread_cfs)
+		test_max_priority ();
+	else if(thread_current()->priority<priority){
 		thread_yield();
 	}
 	return tid;
@@ -265,9 +354,22 @@ thread_unblock (struct thread *t) {
 
 	old_level = intr_disable ();
 	ASSERT (t->status == THREAD_BLOCKED);
-	// list_push_back (&ready_list, &t->elem);
-	list_insert_ordered(&ready_list,&t->elem,thread_order,NULL);
+	if (thread_mlfqs) {
+		recal_recent (t);
+		recal_pri (t);
+	}
+	spin_lock (&ready_lock);
+	if (thread_cfs) {
+		/* A thread that slept gets ahead of the others by at most
+		   one granularity. */
+		int64_t floor = min_vruntime
+			- (int64_t) thread_cfs_granularity * CFS_NICE_0;
+		if (t->vruntime < floor)
+			t->vruntime = floor;
+	}
+	ready_push (t);
 	t->status = THREAD_READY;
+	spin_unlock (&ready_lock);
 	intr_set_level (old_level);
 }
 
@@ -310,11 +412,12 @@ thread_exit (void) {
 #ifdef USERPROG
 	process_exit ();
 #endif
-	if(thread_mlfqs)
-		list_remove(&thread_current()->allelem);
 	/* Just set our status to dying and schedule another process.
 	   We will be destroyed during the call to schedule_tail(). */
 	intr_disable ();
+	if(thread_mlfqs){
+		list_remove(&thread_current()->allelem);
+	}
 	do_schedule (THREAD_DYING);
 	NOT_REACHED ();
 }
@@ -329,8 +432,11 @@ thread_yield (void) {
 	ASSERT (!intr_context ());
 
 	old_level = intr_disable ();
-	if (curr != idle_thread)
-		list_insert_ordered(&ready_list,&curr->elem,thread_order,NULL);
+	if (curr != idle_thread) {
+		spin_lock (&ready_lock);
+		ready_push (curr);
+		spin_unlock (&ready_lock);
+	}
 	do_schedule (THREAD_READY);
 	intr_set_level (old_level);
 }
@@ -353,10 +459,15 @@ thread_get_priority (void) {
 
 /* Sets the current thread's nice value to NICE. */
 void
-thread_set_nice (int nice UNUSED) {
+thread_set_nice (int nice) {
 	struct thread *t = thread_current();
 	enum intr_level old_level;
 	old_level = intr_disable();
+	recal_recent(t);
+	if (nice < NICE_MIN)
+		nice = NICE_MIN;
+	else if (nice > NICE_MAX)
+		nice = NICE_MAX;
 	t->nice = nice;
 	recal_pri(t);
 	test_max_priority();
@@ -393,6 +504,7 @@ thread_get_recent_cpu (void) {
 	struct thread *t = thread_current();
 	enum intr_level old_level;
 	old_level = intr_disable();
+	recal_recent(t);
 	int recent_R = convert_int(mult_fpn(t->recent_cpu,100));
 	intr_set_level(old_level);
 	return recent_R;
@@ -417,8 +529,22 @@ idle (void *idle_started_ UNUSED) {
 	for (;;) {
 		/* Let someone else run. */
 		intr_disable ();
+		timer_idle_exit ();
 		thread_block ();
 
+		/* Nothing else wants the CPU, so zero pages for PAL_ZERO
+		   requests until something does or the stashes are full. */
+		intr_enable ();
+		while (ready_cnt == 0 && palloc_zero_idle ())
+			continue;
+		intr_disable ();
+		if (ready_cnt != 0)
+			continue;
+
+		/* In tickless mode, sleep until the next timer deadline
+		   instead of waking up every tick. */
+		timer_idle_enter ();
+
 		/* Re-enable interrupts and wait for the next one.
 
 		   The `sti' instruction disables interrupts until the
@@ -456,7 +582,6 @@ init_thread (struct thread *t, const char *name, int priority) {
 	memset (t, 0, sizeof *t);
 	t->status = THREAD_BLOCKED;
 	strlcpy (t->name, name, sizeof t->name);
-	t->tf.rsp = (uint64_t) t + PGSIZE - sizeof (void *);
 	if(thread_mlfqs){
 		recal_pri(t);
 		list_push_back(&all_list,&t->allelem);
@@ -465,10 +590,12 @@ init_thread (struct thread *t, const char *name, int priority) {
 	}
 	t->magic = THREAD_MAGIC;
 	t->opriority = priority;
-	list_init(&t->donates);
+	list_init(&t->held_locks);
 	t->wait = NULL;
 	t->nice = 0;
 	t->recent_cpu = 0;
+	t->decay_epoch = decay_epoch;
+	t->vruntime = min_vruntime;
 	#ifdef USERPROG
 	list_init(&t->children);
 	sema_init(&t->pwait,0);
@@ -486,13 +613,119 @@ init_thread (struct thread *t, const char *name, int priority) {
    idle_thread. */
 static struct thread *
 next_thread_to_run (void) {
-	if (list_empty (&ready_list))
-		return idle_thread;
-	else
-		return list_entry (list_pop_front (&ready_list), struct thread, elem);
+	struct thread *next = idle_thread;
+
+	spin_lock (&ready_lock);
+	if (ready_cnt != 0)
+		next = ready_pop ();
+	spin_unlock (&ready_lock);
+	return next;
+}
+
+/* Appends T to the ready queue of its priority, or inserts it in
+   the fair-share queue.
+   Must be called with ready_lock held, as must the other ready_*
+   functions. */
+static void
+ready_push (struct thread *t) {
+	ASSERT (ready_lock.locked);
+	ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+	if (thread_cfs) {
+		heap_push (&cfs_queue, &t->relem);
+		ready_cnt++;
+		return;
+	}
+	list_push_back (&ready_queues[t->priority], &t->elem);
+	ready_mask |= 1ULL << t->priority;
+	ready_cnt++;
+}
+
+/* Removes ready thread T from its ready queue. */
+static void
+ready_remove (struct thread *t) {
+	ASSERT (ready_lock.locked);
+
+	if (thread_cfs) {
+		heap_remove (&cfs_queue, &t->relem);
+		ready_cnt--;
+		return;
+	}
+	list_remove (&t->elem);
+	if (list_empty (&ready_queues[t->priority]))
+		ready_mask &= ~(1ULL << t->priority);
+	ready_cnt--;
+}
+
+/* Removes and returns the first thread of the highest nonempty
+   ready queue, or the one with the least virtual runtime, which
+   must exist. */
+static struct thread *
+ready_pop (void) {
+	struct thread *t;
+
+	if (thread_cfs) {
+		t = heap_entry (heap_top (&cfs_queue), struct thread, relem);
+		ready_remove (t);
+		if (t->vruntime > min_vruntime)
+			min_vruntime = t->vruntime;
+		return t;
+	}
+	t = list_entry (list_front (&ready_queues[ready_max_priority ()]),
+			struct thread, elem);
+	ready_remove (t);
+	return t;
 }
 
-/* Use iretq to launch the thread */
+/* Returns the highest priority of a ready thread, or -1 if no
+   thread is ready. */
+static int
+ready_max_priority (void) {
+	return ready_mask ? 63 - __builtin_clzll (ready_mask) : -1;
+}
+
+/* Sets T's effective priority to PRIORITY, moving T to the back
+   of the matching ready queue if it is ready, or to its new place
+   among a semaphore's waiters if it is waiting for one, and among a
+   condition variable's waiters if it is waiting on one. */
+void
+thread_set_effective_priority (struct thread *t, int priority) {
+	enum intr_level old_level = intr_disable ();
+
+	if (priority < PRI_MIN)
+		priority = PRI_MIN;
+	else if (priority > PRI_MAX)
+		priority = PRI_MAX;
+	if (t->priority != priority) {
+		bool ready = t->status == THREAD_READY;
+		struct heap *wait_heap = t->status == THREAD_BLOCKED
+			? t->wait_heap : NULL;
+
+		/* Take T out of every queue keyed on its priority, and put
+		   it back once the key has changed. */
+		if (ready) {
+			spin_lock (&ready_lock);
+			ready_remove (t);
+		}
+		if (wait_heap != NULL)
+			heap_remove (wait_heap, &t->welem);
+		if (t->cond_heap != NULL)
+			heap_remove (t->cond_heap, t->cond_elem);
+		t->priority = priority;
+		if (t->cond_heap != NULL)
+			heap_push (t->cond_heap, t->cond_elem);
+		if (wait_heap != NULL)
+			heap_push (wait_heap, &t->welem);
+		if (ready) {
+			ready_push (t);
+			spin_unlock (&ready_lock);
+		}
+	}
+	intr_set_level (old_level);
+}
+
+/* Uses iretq to enter the context in TF.  Used to start user
+   processes; thread switches go through switch_threads(). */
 void
 do_iret (struct intr_frame *tf) {
 	__asm __volatile(
@@ -520,73 +753,17 @@ do_iret (struct intr_frame *tf) {
 			: : "g" ((uint64_t) tf) : "memory");
 }
 
-/* Switching the thread by activating the new thread's page
-   tables, and, if the previous thread is dying, destroying it.
-
-   At this function's invocation, we just switched from thread
-   PREV, the new thread is already running, and interrupts are
-   still disabled.
+/* Switches from the running thread to TH.  Only the callee-saved
+   registers and the stack pointer are saved; see switch.S.
 
-   It's not safe to call printf() until the thread switch is
-   complete.  In practice that means that printf()s should be
-   added at the end of the function. */
+   At this function's invocation, the new thread is already marked
+   running, its page tables are active, and interrupts are still
+   disabled.  When it returns, some other thread has switched back
+   to us. */
 static void
 thread_launch (struct thread *th) {
-	uint64_t tf_cur = (uint64_t) &running_thread ()->tf;
-	uint64_t tf = (uint64_t) &th->tf;
 	ASSERT (intr_get_level () == INTR_OFF);
-
-	/* The main switching logic.
-	 * We first restore the whole execution context into the intr_frame
-	 * and then switching to the next thread by calling do_iret.
-	 * Note that, we SHOULD NOT use any stack from here
-	 * until switching is done. */
-	__asm __volatile (
-			/* Store registers that will be used. */
-			"push %%rax\n"
-			"push %%rbx\n"
-			"push %%rcx\n"
-			/* Fetch input once */
-			"movq %0, %%rax\n"
-			"movq %1, %%rcx\n"
-			"movq %%r15, 0(%%rax)\n"
-			"movq %%r14, 8(%%rax)\n"
-			"movq %%r13, 16(%%rax)\n"
-			"movq %%r12, 24(%%rax)\n"
-			"movq %%r11, 32(%%rax)\n"
-			"movq %%r10, 40(%%rax)\n"
-			"movq %%r9, 48(%%rax)\n"
-			"movq %%r8, 56(%%rax)\n"
-			"movq %%rsi, 64(%%rax)\n"
-			"movq %%rdi, 72(%%rax)\n"
-			"movq %%rbp, 80(%%rax)\n"
-			"movq %%rdx, 88(%%rax)\n"
-			"pop %%rbx\n"              // Saved rcx
-			"movq %%rbx, 96(%%rax)\n"
-			"pop %%rbx\n"              // Saved rbx
-			"movq %%rbx, 104(%%rax)\n"
-			"pop %%rbx\n"              // Saved rax
-			"movq %%rbx, 112(%%rax)\n"
-			"addq $120, %%rax\n"
-			"movw %%es, (%%rax)\n"
-			"movw %%ds, 8(%%rax)\n"
-			"addq $32, %%rax\n"
-			"call __next\n"         // read the current rip.
-			"__next:\n"
-			"pop %%rbx\n"
-			"addq $(out_iret -  __next), %%rbx\n"
-			"movq %%rbx, 0(%%rax)\n" // rip
-			"movw %%cs, 8(%%rax)\n"  // cs
-			"pushfq\n"
-			"popq %%rbx\n"
-			"mov %%rbx, 16(%%rax)\n" // eflags
-			"mov %%rsp, 24(%%rax)\n" // rsp
-			"movw %%ss, 32(%%rax)\n"
-			"mov %%rcx, %%rdi\n"
-			"call do_iret\n"
-			"out_iret:\n"
-			: : "g"(tf_cur), "g" (tf) : "memory"
-			);
+	switch_threads (&running_thread ()->switch_rsp, th->switch_rsp);
 }
 
 /* Schedules a new process. At entry, interrupts must be off.
@@ -600,7 +777,7 @@ do_schedule(int status) {
 	while (!list_empty (&destruction_req)) {
 		struct thread *victim =
 			list_entry (list_pop_front (&destruction_req), struct thread, elem);
-		palloc_free_page(victim);
+		thread_page_put (victim);
 	}
 	thread_current ()->status = status;
 	schedule ();
@@ -644,6 +821,40 @@ schedule (void) {
 	}
 }
 
+/* Returns a page for a new thread, preferring one left by a dead
+   thread.  Only the struct thread is initialized, by init_thread(),
+   so the page is not zeroed.  Returns a null pointer if memory is
+   exhausted. */
+static struct thread *
+thread_page_get (void) {
+	struct thread *t = NULL;
+	enum intr_level old_level = intr_disable ();
+
+	if (!list_empty (&thread_cache)) {
+		t = list_entry (list_pop_front (&thread_cache), struct thread, elem);
+		thread_cache_cnt--;
+	}
+	intr_set_level (old_level);
+	return t != NULL ? t : palloc_get_page (0);
+}
+
+/* Releases the page of dead thread T, keeping it for reuse unless
+   the cache is full. */
+static void
+thread_page_put (struct thread *t) {
+	enum intr_level old_level = intr_disable ();
+
+	if (thread_cache_cnt < THREAD_CACHE_MAX) {
+		t->magic = 0;
+		list_push_front (&thread_cache, &t->elem);
+		thread_cache_cnt++;
+		t = NULL;
+	}
+	intr_set_level (old_level);
+	if (t != NULL)
+		palloc_free_page (t);
+}
+
 /* Returns a tid to use for a new thread. */
 static tid_t
 allocate_tid (void) {
@@ -656,49 +867,74 @@ allocate_tid (void) {
 
 	return tid;
 }
+/* Timer callback that wakes the sleeping thread AUX. */
+static void
+thread_wakeup (void *aux) {
+	thread_unblock (aux);
+}
+
+/* Blocks the running thread until timer tick TIKS. */
 void thread_sleep(int64_t tiks){
 	struct thread *cur = thread_current();
 	enum intr_level old_level;
 	ASSERT (!intr_context ());
+	ASSERT (cur != idle_thread);
 
 	old_level = intr_disable ();
-	cur->wakeup = tiks;
-	if(cur != idle_thread){
-		list_push_back(&sleeplist,&cur->elem);
-	}
+	timer_event_init (&cur->sleep_timer, thread_wakeup, cur);
+	timer_event_arm (&cur->sleep_timer, tiks);
 	thread_block();
 	intr_set_level (old_level);
 }
-void thread_wakeup(int64_t tiks){
-	struct list_elem *e;
-	e = list_begin(&sleeplist);
-	while(e!=list_end(&sleeplist)){
-		struct thread *t = list_entry(e,struct thread,elem);
-		if(t->wakeup <= tiks){
-			e = list_remove(&t->elem);
-			thread_unblock(t);
-		}else{
-			e = list_next(e);
-		}
-	}
-
+/* Orders the fair-share queue by virtual runtime. */
+static bool
+cfs_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct thread *a = heap_entry (a_, struct thread, relem);
+	const struct thread *b = heap_entry (b_, struct thread, relem);
+
+	if (a->vruntime != b->vruntime)
+		return a->vruntime < b->vruntime;
+	return a->tid < b->tid;
 }
-bool thread_order(struct list_elem *a,struct list_elem *b,void *aux UNUSED){
-	struct thread *a1 = list_entry(a,struct thread,elem);
-	struct thread *b1 = list_entry(b,struct thread,elem);
-	if (a1 == NULL || b1 == NULL)
-		return false;
-	return a1->priority>b1->priority;
+
+/* Returns true if a ready thread has run less than running thread
+   CUR by more than MARGIN of virtual runtime. */
+static bool
+cfs_should_preempt (struct thread *cur, int64_t margin) {
+	bool preempt;
+
+	spin_lock (&ready_lock);
+	if (ready_cnt == 0)
+		preempt = false;
+	else if (cur == idle_thread)
+		preempt = true;
+	else
+		preempt = heap_entry (heap_top (&cfs_queue), struct thread,
+				relem)->vruntime + margin < cur->vruntime;
+	spin_unlock (&ready_lock);
+	return preempt;
 }
+
 void 
 test_max_priority (void) 
 {
-    if (list_empty(&ready_list))
-        return;
-
-    struct thread *th = list_entry(list_front(&ready_list), struct thread, elem);
-
-    if (thread_get_priority() < th->priority){
+    if (thread_cfs) {
+		/* A woken thread preempts only if it is a full granularity
+		   behind, so that wakeups do not cause thrashing. */
+		if (cfs_should_preempt (thread_current (),
+					(int64_t) thread_cfs_granularity * CFS_NICE_0)) {
+			if (intr_context ())
+				intr_yield_on_return ();
+			else
+				thread_yield ();
+		}
+		return;
+    }
+    spin_lock (&ready_lock);
+    int max_priority = ready_max_priority ();
+    spin_unlock (&ready_lock);
+    if (thread_get_priority() < max_priority){
 		if(intr_context()){
 			intr_yield_on_return();
 		}else{
@@ -710,49 +946,80 @@ void up_recent(){
 	struct thread *t = thread_current();
 	if (thread_current() == idle_thread)
         return;
+	recal_recent(t);
 	t->recent_cpu = add_fpn(t->recent_cpu,1);
 }
 void recal_load(){
 	enum intr_level old_level = intr_disable();
-	int rd = list_size(&ready_list);
+	spin_lock(&ready_lock);
+	int rd = ready_cnt;
+	spin_unlock(&ready_lock);
 	if(thread_current()!= idle_thread)
 		rd = rd+1;
 	load_avg = add_fp(mult_fp(div_fp(convert_fixed(59),convert_fixed(60)),load_avg),mult_fpn(div_fp(convert_fixed(1),convert_fixed(60)),rd));
 	intr_set_level(old_level);
 }
+/* Applies to T the decays of recent_cpu it has missed.  Past
+   DECAY_HIST seconds only the latest DECAY_HIST are applied, which
+   is indistinguishable in fixed point since each one shrinks the
+   old value. */
 void recal_recent(struct thread *t){
-	if (t == idle_thread) 
-    	return ;
-	t->recent_cpu = add_fpn(mult_fp(div_fp(mult_fpn(load_avg, 2), add_fpn(mult_fpn(load_avg, 2), 1)), t->recent_cpu), t->nice);;
+	if (t == idle_thread) {
+		t->decay_epoch = decay_epoch;
+		return ;
+	}
+	if (decay_epoch - t->decay_epoch > DECAY_HIST)
+		t->decay_epoch = decay_epoch - DECAY_HIST;
+	for (; t->decay_epoch < decay_epoch; t->decay_epoch++)
+		t->recent_cpu = add_fpn(mult_fp(decay_coef[t->decay_epoch % DECAY_HIST], t->recent_cpu), t->nice);
 }
 void recal_pri(struct thread *vv){//우선순위 재계산
 	if (vv == idle_thread) 
     	return ;
 	int npri = convert_int(add_fpn(div_fpn(vv->recent_cpu,-4),PRI_MAX - (vv->nice*2)));
-	vv->priority = npri;
+	thread_set_effective_priority (vv, npri);
 }
-void all_recal(){//ready list와 현재 쓰레드의 우선순위를 모두 재계산
+/* Every 4 ticks: only the running thread's recent_cpu has grown,
+   so only its priority is recomputed.  Blocked threads catch up on
+   decay when they are unblocked. */
+void recal_quantum(){
 	enum intr_level old_level = intr_disable();
-	struct list_elem *e;
-	struct thread *item = NULL;
-	for (e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e)) {
-    // list_entry를 사용해서 list_elem이 속한 구조체를 가져옵니다.
-    item = list_entry(e, struct thread, allelem);
-    // item을 사용한 작업 수행
-	recal_pri(item);
-	}
-	list_sort(&ready_list,thread_order,NULL);
+	struct thread *cur = thread_current();
+
+	recal_recent(cur);
+	recal_pri(cur);
 	intr_set_level(old_level);
 }
-void all_recal_r(){//ready list와 현재 쓰레드의 우선순위를 모두 재계산
+/* Every second: records this second's recent_cpu decay and applies
+   it to the ready threads, so that the ready queues stay in priority
+   order.  The others get it lazily from recal_recent().
+   recal_pri() moves only the thread it is given, and only to the
+   back of another queue, so each queue is walked once; a thread
+   moved to a queue not walked yet is already up to date there. */
+void recal_decay(){
 	enum intr_level old_level = intr_disable();
-	struct list_elem *e;
-	struct thread *item = NULL;
-	for (e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e)) {
-    // list_entry를 사용해서 list_elem이 속한 구조체를 가져옵니다.
-    item = list_entry(e, struct thread, allelem);
-    // item을 사용한 작업 수행
-	recal_recent(item);
+	int p;
+
+	decay_coef[decay_epoch % DECAY_HIST] = div_fp(mult_fpn(load_avg, 2), add_fpn(mult_fpn(load_avg, 2), 1));
+	decay_epoch++;
+	for (p = PRI_MAX; p >= PRI_MIN; p--) {
+		struct list_elem *e;
+
+		spin_lock(&ready_lock);
+		if (!(ready_mask & (1ULL << p))) {
+			spin_unlock(&ready_lock);
+			continue;
+		}
+		e = list_begin(&ready_queues[p]);
+		while (e != list_end(&ready_queues[p])) {
+			struct thread *t = list_entry(e, struct thread, elem);
+			e = list_next(e);
+			spin_unlock(&ready_lock);
+			recal_recent(t);
+			recal_pri(t);
+			spin_lock(&ready_lock);
+		}
+		spin_unlock(&ready_lock);
 	}
 	intr_set_level(old_level);
 }
@@ -13,6 +13,7 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
@@ -117,7 +118,7 @@ duplicate_pte (uint64_t *pte, void *va, void *aux) {
 	/* 4. TODO: Duplicate parent's page to the new page and
 	 *    TODO: check whether parent's page is writable or not (set WRITABLE
 	 *    TODO: according to the result). */
-	memcpy(newpage,parent_page,PGSIZE);
+	copy_page(newpage,parent_page);
 	writable = is_writable(pte);
 	/* 5. Add new page to child's page table at address VA with WRITABLE
 	 *    permission. */
@@ -130,7 +131,7 @@ duplicate_pte (uint64_t *pte, void *va, void *aux) {
 #endif
 
 /* A thread function that copies parent's execution context.
- * Hint) parent->tf does not hold the userland context of the process.
+ * Hint) the parent's switch context does not hold its userland context.
  *       That is, you are required to pass second argument of process_fork to
  *       this function. */
 static void
@@ -165,11 +166,16 @@ __do_fork (void *aux) {
 	 * TODO:       in include/filesys/file.h. Note that parent should not return
 	 * TODO:       from the fork() until this function successfully duplicates
 	 * TODO:       the resources of parent.*/
-	if(parent->fdcnt>128)
+	if(parent->fdcnt>FDT_SIZE)
 		goto error;
 	ft = parent->fdcnt;
 	current->fdcnt = ft;
-	for(int i = 3;i<ft;i++){
+	if(parent->fdt != NULL){
+		current->fdt = calloc(FDT_SIZE, sizeof *current->fdt);
+		if(current->fdt == NULL)
+			goto error;
+	}
+	for(int i = 3;i<ft && parent->fdt != NULL;i++){
 		if(parent->fdt[i] == NULL){
 			continue;
 		}
@@ -282,7 +288,7 @@ process_exit (void) {
 	 * TODO: Implement process termination message (see
 	 * TODO: project2/process_termination.html).
 	 * TODO: We recommend you to implement process resource cleanup here. */
-	for (int i = 0;i<curr->fdcnt;i++){
+	for (int i = 0;curr->fdt != NULL && i<curr->fdcnt;i++){
 		// close_file(i);
 		if(curr->fdt[i] != NULL){
 			close(i);
@@ -297,7 +303,8 @@ process_exit (void) {
    
 	}
 	file_close(curr->running);
-	palloc_free_page(curr->fdt);
+	free(curr->fdt);
+	curr->fdt = NULL;
 	process_cleanup ();
 	// palloc_free_page(curr->fdt);
 	sema_up(&curr->pwait);
@@ -714,7 +721,9 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		 * and zero the final PAGE_ZERO_BYTES bytes. */
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
-		struct load_arg *aux = (struct load_arg *)malloc(sizeof(struct load_arg));
+		struct load_arg *aux = kmem_cache_alloc (&load_arg_cache);
+		if (aux == NULL)
+			return false;
 
         aux -> file = file;
         aux -> offset = ofs;
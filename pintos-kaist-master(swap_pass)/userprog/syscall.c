@@ -14,6 +14,7 @@
 #include "lib/user/syscall.h"
 #include "threads/synch.h"
 #include "threads/palloc.h"
+#include "threads/malloc.h"
 #include "lib/string.h"
 #include "userprog/process.h"
 void syscall_entry (void);
@@ -35,6 +36,7 @@ struct lock synclock;
 void
 syscall_init (void) {
 	lock_init(&synclock);
+	lock_set_name(&synclock, "synclock");
 	write_msr(MSR_STAR, ((uint64_t)SEL_UCSEG - 0x10) << 48  |
 			((uint64_t)SEL_KCSEG) << 32);
 	write_msr(MSR_LSTAR, (uint64_t) syscall_entry);
@@ -312,15 +314,20 @@ void munmap (void *addr){
 struct file* get_file(int fd){
 	struct thread *t = thread_current();
 	struct file **fdt = t->fdt;
-	if(fd<0||fd>=t->fdcnt){
+	if(fdt == NULL||fd<0||fd>=t->fdcnt){
 		return NULL;
 	}
 	return fdt[fd];
 }
 int add_file(struct file *f){
 	struct thread *t = thread_current();
-	if(f == NULL||t->fdcnt>=128)
+	if(f == NULL||t->fdcnt>=FDT_SIZE)
 		return -1;
+	if(t->fdt == NULL){
+		t->fdt = calloc(FDT_SIZE, sizeof *t->fdt);
+		if(t->fdt == NULL)
+			return -1;
+	}
 	struct file **fdt = t->fdt;
 	if(t->fdcnt>3){
 	for(int i = 3;i<t->fdcnt;i++){
@@ -335,7 +342,7 @@ int add_file(struct file *f){
 }
 void close_file(int fd){
 	struct thread *t = thread_current();
-	if(fd>=t->fdcnt|| t->fdt[fd] == NULL){
+	if(t->fdt == NULL||fd<0||fd>=t->fdcnt|| t->fdt[fd] == NULL){
 		return -1;
 	}
 	struct file **fdt = t->fdt;
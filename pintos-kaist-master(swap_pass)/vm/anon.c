@@ -6,6 +6,7 @@
 #include "lib/kernel/bitmap.h"
 #include "threads/mmu.h"
 #include "string.h"
+#include "threads/malloc.h"
 #define SECTOR_PER_PAGE (PGSIZE / DISK_SECTOR_SIZE)
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -14,6 +15,16 @@ static bool anon_swap_out (struct page *page);
 static void anon_destroy (struct page *page);
 struct bitmap *swapmap;
 struct lock swaplock;
+/* Number of pages referring to each swap slot.  A slot is shared when
+ * a copy-on-write frame is evicted or a process forks while some of
+ * its pages are swapped out. */
+static int *swap_refs;
+/* The page swapped out to each slot when that page is its only user,
+ * NULL otherwise.  Lets swap-in find the neighbours of a slot that
+ * belong to the same address space. */
+static struct page **swap_owner;
+/* Most slots read ahead after the faulting one. */
+#define SWAP_READAHEAD 8
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations anon_ops = {
@@ -31,7 +42,12 @@ vm_anon_init (void) {
 	ASSERT(swap_disk != NULL);
 	swapmap = bitmap_create(disk_size(swap_disk) / SECTOR_PER_PAGE);
 	ASSERT(swapmap != NULL);
+	swap_refs = calloc(bitmap_size(swapmap), sizeof *swap_refs);
+	ASSERT(swap_refs != NULL);
+	swap_owner = calloc(bitmap_size(swapmap), sizeof *swap_owner);
+	ASSERT(swap_owner != NULL);
 	lock_init(&swaplock);
+	lock_set_name(&swaplock, "swaplock");
 }
 
 /* Initialize the file mapping */
@@ -47,59 +63,177 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	return true;
 }
 
-/* Swap in the page by read contents from the swap disk. */
+/* Drops one reference to swap slot PAGENO and frees the slot when it
+ * was the last one.  Must be called with swaplock held. */
+static void
+swap_slot_put (size_t pageno) {
+	ASSERT (swap_refs[pageno] > 0);
+	if (--swap_refs[pageno] == 0) {
+		swap_owner[pageno] = NULL;
+		bitmap_set(swapmap, pageno, false);
+	}
+}
+
+/* Makes PAGE, a copy of a swapped out anonymous page, share the swap
+ * slot of the original. */
+void
+anon_swap_dup (struct page *page) {
+	struct anon_page *anon_page = &page->anon;
+	if (anon_page->pageno == BITMAP_ERROR)
+		return;
+	lock_acquire(&swaplock);
+	swap_refs[anon_page->pageno]++;
+	swap_owner[anon_page->pageno] = NULL;
+	lock_release(&swaplock);
+}
+
+/* Returns the page that slot PAGENO can be read ahead into on behalf
+ * of PAGE: the sole, non-resident user of the slot living in the same
+ * address space.  Returns NULL if there is none.
+ * Must be called with swaplock held. */
+static struct page *
+swap_readahead_page (struct page *page, size_t pageno) {
+	if (pageno >= bitmap_size(swapmap) || !bitmap_test(swapmap, pageno))
+		return NULL;
+	struct page *owner = swap_owner[pageno];
+	if (owner == NULL || swap_refs[pageno] != 1
+			|| owner->pml4 != page->pml4 || owner->frame != NULL
+			|| owner->anon.pageno != pageno)
+		return NULL;
+	return owner;
+}
+
+/* Swap in the page by read contents from the swap disk.
+ * The slots following PAGE's that hold other pages of the same
+ * address space are read by the same disk command into free frames,
+ * if any, and mapped right away. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	struct page *ra_pages[SWAP_READAHEAD];
+	struct frame *ra_frames[SWAP_READAHEAD];
+	void *bufs[SWAP_READAHEAD + 1];
+	size_t pageno, ra_cnt, got, i;
+
 	lock_acquire(&swaplock);
-	if (bitmap_test(swapmap, anon_page->pageno) == false){
+	pageno = anon_page->pageno;
+	if (bitmap_test(swapmap, pageno) == false){
 		lock_release(&swaplock);
         PANIC("(anon swap in) Frame not stored in the swap slot!\n");
 	}
-	for(int i = 0;i<SECTOR_PER_PAGE;i++){
-		disk_read(swap_disk,(anon_page->pageno*SECTOR_PER_PAGE) + i, kva + (DISK_SECTOR_SIZE* i) );
+	for (ra_cnt = 0; ra_cnt < SWAP_READAHEAD; ra_cnt++)
+		if (swap_readahead_page(page, pageno + 1 + ra_cnt) == NULL)
+			break;
+	lock_release(&swaplock);
+
+	/* Getting frames may take vlock, which must not be acquired while
+	 * holding swaplock.  Never evict for a speculative read. */
+	for (i = 0; i < ra_cnt; i++)
+		if ((ra_frames[i] = vm_get_free_frame()) == NULL)
+			break;
+	ra_cnt = i;
+
+	lock_acquire(&swaplock);
+	/* Recheck: the slots may have changed hands without the lock. */
+	for (i = 0; i < ra_cnt; i++) {
+		ra_pages[i] = swap_readahead_page(page, pageno + 1 + i);
+		if (ra_pages[i] == NULL)
+			break;
+	}
+	got = ra_cnt;
+	ra_cnt = i;
+
+	bufs[0] = kva;
+	for (i = 0; i < ra_cnt; i++) {
+		bufs[i + 1] = ra_frames[i]->kva;
+		/* Not swapped out anymore once installed below, so that a
+		 * racing eviction can store its new slot number. */
+		ra_pages[i]->anon.pageno = BITMAP_ERROR;
 	}
-	bitmap_set(swapmap, anon_page->pageno, false);
-	pml4_set_page(thread_current()->pml4, page->va, kva, true);
+	disk_readv(swap_disk, pageno * SECTOR_PER_PAGE, bufs, ra_cnt + 1, SECTOR_PER_PAGE);
+	swap_slot_put(pageno);
 	anon_page->pageno = BITMAP_ERROR;
 	lock_release(&swaplock);
+
+	for (i = ra_cnt; i < got; i++)
+		vm_put_frame(ra_frames[i]);
+	for (i = 0; i < ra_cnt; i++)
+		if (!vm_frame_install(ra_frames[i], ra_pages[i])) {
+			/* Keep the slot; the page is faulted in normally later. */
+			ra_pages[i]->anon.pageno = pageno + 1 + i;
+			vm_put_frame(ra_frames[i]);
+			ra_pages[i] = NULL;
+		}
+
+	lock_acquire(&swaplock);
+	for (i = 0; i < ra_cnt; i++)
+		if (ra_pages[i] != NULL)
+			swap_slot_put(pageno + 1 + i);
+	lock_release(&swaplock);
 	return true;
 }
 
-/* Swap out the page by writing contents to the swap disk. */
-static bool
-anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+/* Swaps out the CNT frames in FRAMES, all holding anonymous pages, to
+ * adjacent slots with one disk write.  If no run of CNT free slots is
+ * left, fewer frames are swapped out; the first N of FRAMES are done,
+ * and N is returned.  Every page sharing one of those frames is
+ * unmapped and refers to its slot afterwards.
+ * Called by the evictor with vlock held. */
+size_t
+anon_swap_out_cluster (struct frame *frames[], size_t cnt) {
+	const void *bufs[SWAP_CLUSTER];
+	size_t pageno, i;
+
+	ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
 	lock_acquire(&swaplock);
-	size_t pageno = bitmap_scan_and_flip(swapmap,0,1,false);
-	if(pageno == BITMAP_ERROR){
-		lock_release(&swaplock);
-		PANIC("no slot! recent\n");
-		return false;
+	while ((pageno = bitmap_scan_and_flip(swapmap, 0, cnt, false)) == BITMAP_ERROR) {
+		if (cnt == 1) {
+			lock_release(&swaplock);
+			PANIC("no slot! recent\n");
+		}
+		cnt /= 2;
 	}
-	for(int i = 0;i<SECTOR_PER_PAGE;i++){
-		disk_write(swap_disk,pageno*SECTOR_PER_PAGE + i,page->va + DISK_SECTOR_SIZE * i);
+	for (i = 0; i < cnt; i++)
+		bufs[i] = frames[i]->kva;
+	disk_writev(swap_disk, pageno * SECTOR_PER_PAGE, bufs, cnt, SECTOR_PER_PAGE);
+
+	for (i = 0; i < cnt; i++) {
+		struct frame *frame = frames[i];
+		swap_refs[pageno + i] = frame->ref_cnt;
+		swap_owner[pageno + i] = frame->ref_cnt == 1 ? frame->page : NULL;
+		while (!list_empty(&frame->pages)) {
+			struct page *p = list_entry(list_pop_front(&frame->pages), struct page, frame_elem);
+			pml4_clear_page(p->pml4, p->va);
+			p->anon.pageno = pageno + i;
+			p->frame = NULL;
+		}
+		frame->page = NULL;
+		frame->ref_cnt = 0;
 	}
-	pml4_clear_page(thread_current()->pml4, page->va);
-	anon_page->pageno = pageno;
-	page->frame->page = NULL;
-	page->frame = NULL;
 	lock_release(&swaplock);
+	return cnt;
+}
+
+/* Swap out the page by writing contents to the swap disk.
+ * Every page sharing PAGE's frame is unmapped and refers to the same
+ * slot afterwards.  Called by the evictor with vlock held. */
+static bool
+anon_swap_out (struct page *page) {
+	struct frame *frame = page->frame;
+	return anon_swap_out_cluster(&frame, 1) == 1;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	if (page->frame)
+		vm_frame_release(page);
 	if(anon_page->pageno != BITMAP_ERROR){
-		bitmap_set(swapmap, anon_page->pageno, false);
-	}
-	if (page->frame) {
 		lock_acquire(&swaplock);
-        list_remove(&page->frame->ft_elem);
+		swap_slot_put(anon_page->pageno);
 		lock_release(&swaplock);
-        page->frame->page = NULL;
-		page->frame = NULL;
-        palloc_free_page(page->frame);
-    }
+		anon_page->pageno = BITMAP_ERROR;
+	}
 }
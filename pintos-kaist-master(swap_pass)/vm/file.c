@@ -1,6 +1,8 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
+#include <string.h>
 #include "vm/vm.h"
+#include "filesys/inode.h"
 #include "threads/mmu.h"
 #include "threads/vaddr.h"
 #include "userprog/process.h"
@@ -9,7 +11,6 @@
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
 static void file_backed_destroy (struct page *page);
-static bool lazy_load_segment_f(struct page *page, void *aux);
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations file_ops = {
@@ -40,51 +41,56 @@ file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
 	return true;
 }
 
-/* Swap in the page by read contents from the file. */
+/* File pages are normally not filled on their own: vm_do_claim_page
+ * maps them to the frame of the page cache with page_cache_map.  If
+ * one is filled anyway, it is read straight from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
-	/** Project 3-Swap In/Out */
-	int read = file_read_at(file_page->file, page->frame->kva, file_page->read_b, file_page->ofs);
-	memset(page->frame->kva + read, 0, PGSIZE - read);
+	struct file_page *file_page = &page->file;
+	off_t read_b = file_page->read_b;
+
+	if (inode_read_at (file_get_inode (file_page->file), kva, read_b,
+				file_page->ofs) != read_b)
+		return false;
+	memset ((uint8_t *) kva + read_b, 0, PGSIZE - read_b);
 	return true;
 }
 
-/* Swap out the page by writeback contents to the file. */
+/* The page cache page that a file page shares its frame with is linked
+ * to the frame first and so handles its eviction; see
+ * page_cache_writeback.  A file page only owns a frame once that page
+ * cache page was dropped under it.  Then the frame is unmapped from
+ * every page sharing it and what they wrote goes to the file directly,
+ * since the page cache must not be entered under vlock.
+ * Called by the evictor with vlock held. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
-	/** Project 3-Swap In/Out */
 	struct frame *frame = page->frame;
-	struct load_arg* container = (struct load_arg *)page->uninit.aux;
-	if (pml4_is_dirty(thread_current()->pml4, page->va))
-	{
-		file_write_at(container->file, page->va, container->read_b, container->offset);
-		pml4_set_dirty(thread_current()->pml4, page->va, false);
+	bool dirty = false;
+
+	while (!list_empty (&frame->pages)) {
+		struct page *p = list_entry (list_pop_front (&frame->pages),
+				struct page, frame_elem);
+		if (p->pml4 != NULL) {
+			dirty |= pml4_is_dirty (p->pml4, p->va);
+			pml4_clear_page (p->pml4, p->va);
+		}
+		p->frame = NULL;
 	}
-	page->frame->page = NULL;
-	page->frame = NULL;
-	pml4_clear_page(thread_current()->pml4, page->va);
+	if (dirty && page->file.writable)
+		inode_write_at (file_get_inode (page->file.file), frame->kva,
+				page->file.read_b, page->file.ofs);
+	frame->page = NULL;
+	frame->ref_cnt = 0;
 	return true;
 }
 
-/* Destory the file backed page. PAGE will be freed by the caller. */
+/* Destory the file backed page. PAGE will be freed by the caller.
+ * What it wrote stays in the page cache until written back. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
-	
-    if (pml4_is_dirty(thread_current()->pml4, page->va))
-    {
-        file_write_at(file_page->file, page->va, PGSIZE-file_page->zero_b, file_page->ofs);
-        pml4_set_dirty(thread_current()->pml4, page->va, 0);
-    }
-	 if (page->frame) {
-        list_remove(&page->frame->ft_elem);
-        page->frame->page = NULL;
-        page->frame = NULL;
-        free(page->frame);
-    }
-    pml4_clear_page(thread_current()->pml4, page->va);
+	if (page->frame)
+		page_cache_unmap(page);
 }
 
 /* Do the mmap */
@@ -111,7 +117,7 @@ do_mmap (void *addr, size_t length, int writable,
 	while(read_bytes>0||zero_bytes>0){
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
-		struct load_arg *aux = malloc(sizeof(struct load_arg));
+		struct load_arg *aux = kmem_cache_alloc(&load_arg_cache);
 		if (!aux)
             return NULL;
 		aux->file = mfile;
@@ -119,7 +125,7 @@ do_mmap (void *addr, size_t length, int writable,
 		aux->read_b = page_read_bytes;
 		aux->zero_b = page_zero_bytes;
 		aux->enablerw = writable;
-		if(!vm_alloc_page_with_initializer(VM_FILE,addr,writable,lazy_load_segment_f,aux)){
+		if(!vm_alloc_page_with_initializer(VM_FILE,addr,writable,NULL,aux)){
 			// free(aux);
 			return NULL;
 		}
@@ -148,23 +154,3 @@ do_munmap (void *addr) {
 	tp = spt_find_page(&thread_current()->spt,addr);
 	}
 }
-static bool
-lazy_load_segment_f(struct page *page, void *aux) {
-	ASSERT(page -> frame -> kva != NULL);
-	struct load_arg* load = (struct load_arg *)aux;
-
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
-	file_seek(load->file,load->offset);
-	size_t read_b = load->read_b;
-	size_t zero_b = load->zero_b;
-	if (file_read(load-> file, page -> frame -> kva, read_b) != (int)read_b) {
-            // palloc_free_page(page->frame->kva);
-            return false;
-    }
-	memset (page -> frame -> kva + read_b, 0, zero_b);
-	file_seek(load->file,load->offset);
-    return true;
-
-}
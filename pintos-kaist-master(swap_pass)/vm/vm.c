@@ -1,26 +1,60 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
-#include "threads/malloc.h"
+#include <string.h>
 #include "vm/vm.h"
 #include "vm/inspect.h"
 #include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 struct list framelist;
 struct lock vlock;
-struct list_elem *next = NULL;
+/* Clock hand over framelist.  It survives across evictions so that
+ * each frame gets a full revolution to be referenced again. */
+static struct list_elem *clock_hand = NULL;
+static size_t frame_cnt;        /* Number of frames in framelist. */
+/* Frames freed by a cluster eviction beyond the one the evictor
+ * needed.  They are not in framelist and are handed out before
+ * anything else is evicted. */
+static struct list free_frames;
+static size_t free_cnt;         /* Number of frames in free_frames. */
+/* Frames the clock may pass over while gathering one swap cluster. */
+#define SWAP_CLUSTER_SCAN 64
+
+/* -swap-low, -swap-high: once the user pool is exhausted, kswapd is
+ * woken when fewer than vm_free_low frames are free and evicts in the
+ * background until vm_free_high are. */
+size_t vm_free_low = 8;
+size_t vm_free_high = 24;
+/* Object caches for pages, frames and lazy-load arguments. */
+struct kmem_cache vm_page_cache;
+static struct kmem_cache frame_cache;
+struct kmem_cache load_arg_cache;
+static struct semaphore kswapd_sema;
+static bool kswapd_woken;       /* kswapd_sema was upped, not yet served. */
+static void kswapd (void *aux);
+static struct frame *get_free_frame (enum palloc_flags);
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
 void
 vm_init (void) {
+	kmem_cache_init (&vm_page_cache, "page", sizeof (struct page), NULL);
+	kmem_cache_init (&frame_cache, "frame", sizeof (struct frame), NULL);
+	kmem_cache_init (&load_arg_cache, "load_arg", sizeof (struct load_arg),
+			NULL);
 	vm_anon_init ();
 	vm_file_init ();
-#ifdef EFILESYS  /* For project 4 */
 	pagecache_init ();
-#endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
 	/* TODO: Your code goes here. */
 	list_init(&framelist);
+	list_init(&free_frames);
 	lock_init(&vlock);
+	lock_set_name(&vlock, "vlock");
+	sema_init(&kswapd_sema, 0);
+	if (vm_free_high < vm_free_low)
+		vm_free_high = vm_free_low;
+	thread_create("kswapd", PRI_DEFAULT, kswapd, NULL);
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -39,8 +73,8 @@ page_get_type (struct page *page) {
 
 /* Helpers */
 static struct frame *vm_get_victim (void);
-static bool vm_do_claim_page (struct page *page);
 static struct frame *vm_evict_frame (void);
+static bool vm_frame_unlink (struct frame *frame, struct page *page);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -57,7 +91,7 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 		/* TODO: Create the page, fetch the initialier according to the VM type,
 		 * TODO: and then create "uninit" page struct by calling uninit_new. You
 		 * TODO: should modify the field after calling the uninit_new. */
-		struct page *np = malloc(sizeof(struct page));
+		struct page *np = kmem_cache_alloc(&vm_page_cache);
 		if(!np){
 			return false;
 		}
@@ -69,10 +103,11 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 				uninit_new(np,upage,init,type,aux,file_backed_initializer);
 				break;
 			default:
-				free(np);
+				kmem_cache_free(&vm_page_cache, np);
 				return(false);
 		}
 		np->writable=writable;
+		np->pml4 = thread_current ()->pml4;
 		/* TODO: Insert the page into the spt. */
 		return spt_insert_page(spt,np);
 	}
@@ -84,10 +119,9 @@ err:
 struct page *
 spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
 	/* TODO: Fill this function. */
-	struct page *mp = malloc(sizeof(struct page));
-	mp->va = pg_round_down(va);
-	struct hash_elem *de = hash_find(&spt->sup_table,&mp->he);
-	free(mp);
+	struct page key;
+	key.va = pg_round_down(va);
+	struct hash_elem *de = hash_find(&spt->sup_table,&key.he);
 	return de != NULL ? hash_entry (de, struct page, he) : NULL;
 }
 
@@ -119,36 +153,251 @@ spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
 	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Returns true if any page mapping FRAME has been accessed since the
+ * last sweep, clearing the accessed bits on the way.  Each sharer is
+ * checked in its own page table; a page cache page, which is mapped in
+ * none, keeps its own bit.  The frames of a 2 MB page share one bit,
+ * which only the last of them clears: they enter the frame table in
+ * order, so each still gets a full revolution to be referenced again.
+ * Must be called with vlock held. */
+static bool
+vm_frame_test_accessed (struct frame *frame) {
+	bool accessed = false;
+	struct list_elem *e;
+	for (e = list_begin(&frame->pages); e != list_end(&frame->pages); e = list_next(e)) {
+		struct page *p = list_entry(e, struct page, frame_elem);
+		if (p->pml4 == NULL) {
+			if (p->page_cache.accessed) {
+				p->page_cache.accessed = false;
+				accessed = true;
+			}
+		} else if (pml4_is_accessed(p->pml4, p->va)) {
+			if (!pml4_is_huge_page(p->pml4, p->va)
+					|| ((uint64_t) p->va + PGSIZE) % HPGSIZE == 0)
+				pml4_set_accessed(p->pml4, p->va, false);
+			accessed = true;
+		}
+	}
+	return accessed;
+}
+
+/* Advances the clock hand over at most *BUDGET frames and returns the
+ * first one that has not been referenced since the last sweep, or
+ * NULL when the budget runs out.  Frames still being filled by
+ * vm_do_claim_page and pinned frames are passed over, and so are
+ * non-anonymous frames if ANON_ONLY and dirty page cache pages, which
+ * would be written back under vlock, if CLEAN_ONLY.
+ * Must be called with vlock held. */
+static struct frame *
+vm_clock_sweep (size_t *budget, bool anon_only, bool clean_only) {
+	while (*budget > 0)
+	{
+		(*budget)--;
+		if (clock_hand == NULL || clock_hand == list_end(&framelist))
+			clock_hand = list_begin(&framelist);
+		struct frame *victim = list_entry(clock_hand, struct frame, ft_elem);
+		clock_hand = list_next(clock_hand);
+		if (victim->page == NULL || victim->pin_cnt > 0)
+			continue;
+		if (anon_only && VM_TYPE(victim->page->operations->type) != VM_ANON)
+			continue;
+		if (vm_frame_test_accessed(victim))
+			continue;
+		if (clean_only && VM_TYPE(victim->page->operations->type) == VM_PAGE_CACHE
+				&& page_cache_test_dirty(victim))
+			continue;
+		return victim;
+	}
+	return NULL;
+}
+
+/* Get the struct frame, that will be evicted.
+ * Second chance clock: a referenced frame has its accessed bits
+ * cleared and is passed over; the first unreferenced one is the victim.
+ * The sweep is bounded by two revolutions, after which every frame
+ * has been cleared once.  Dirty page cache pages are left to the page
+ * cache worker unless there is nothing else to evict.
+ * Must be called with vlock held. */
 static struct frame *
 vm_get_victim (void) {
-	struct frame *victim = NULL;
 	/** Project 3-Swap In/Out */
-	lock_acquire(&vlock);
-	for (next = list_begin(&framelist); next != list_end(&framelist); next = list_next(next))
-	{
-		victim = list_entry(next, struct frame, ft_elem);
-		if (pml4_is_accessed(thread_current()->pml4, victim->page->va))
-			pml4_set_accessed(thread_current()->pml4, victim->page->va, false);
-		else{
+	size_t budget = 2 * frame_cnt;
+	struct frame *victim = vm_clock_sweep(&budget, false, true);
+	if (victim == NULL) {
+		/* Nothing but dirty page cache pages: write one back here. */
+		budget = frame_cnt;
+		victim = vm_clock_sweep(&budget, false, false);
+	}
+	return victim;
+}
+
+/* Inserts FRAME into the frame table just behind the hand, so it is
+ * the last one the next sweep visits.
+ * Must be called with vlock held. */
+static void
+vm_frame_table_insert (struct frame *frame) {
+	if (clock_hand == NULL || clock_hand == list_end(&framelist))
+		list_push_back (&framelist, &frame->ft_elem);
+	else
+		list_insert (clock_hand, &frame->ft_elem);
+	frame_cnt++;
+}
+
+/* Removes FRAME from the frame table.
+ * Must be called with vlock held. */
+static void
+vm_frame_table_remove (struct frame *frame) {
+	if (clock_hand == &frame->ft_elem)
+		clock_hand = list_next(clock_hand);
+	list_remove(&frame->ft_elem);
+	frame_cnt--;
+}
+
+/* Evicts the clock victim.  An anonymous victim is swapped out together
+ * with up to SWAP_CLUSTER - 1 more unreferenced anonymous frames further
+ * along the clock, so they land in adjacent swap slots with one disk
+ * command.  Evicted frames leave the frame table for free_frames.
+ * Must be called with vlock held. */
+static void
+vm_evict_frames (void) {
+	struct frame *cluster[SWAP_CLUSTER];
+	struct frame *victim = vm_get_victim ();
+	size_t n = 0;
+
+	if (victim == NULL)
+		return;
+	if (VM_TYPE(victim->page->operations->type) != VM_ANON) {
+		/* swap_out unmaps every page sharing the victim. */
+		swap_out(victim->page);
+		cluster[n++] = victim;
+	} else {
+		/* Less than one revolution, so no frame is picked twice. */
+		size_t budget = frame_cnt - 1;
+		if (budget > SWAP_CLUSTER_SCAN)
+			budget = SWAP_CLUSTER_SCAN;
+		cluster[n++] = victim;
+		while (n < SWAP_CLUSTER
+				&& (victim = vm_clock_sweep(&budget, true, false)) != NULL)
+			cluster[n++] = victim;
+		n = anon_swap_out_cluster(cluster, n);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		ASSERT (list_empty (&cluster[i]->pages));
+		cluster[i]->page = NULL;
+		cluster[i]->ref_cnt = 0;
+		vm_frame_table_remove(cluster[i]);
+		list_push_back(&free_frames, &cluster[i]->ft_elem);
+		free_cnt++;
+	}
+}
+
+/* Wakes kswapd up unless it is already on its way.
+ * Must be called with vlock held. */
+static void
+kswapd_wake (void) {
+	if (!kswapd_woken) {
+		kswapd_woken = true;
+		sema_up(&kswapd_sema);
+	}
+}
+
+/* Page-out daemon.  Evicts clusters in the background until
+ * vm_free_high frames are free, so that faults find a clean frame
+ * instead of waiting for a victim to be written.  Never leaves more
+ * frames free than in use, which would only make the working set
+ * thrash.  vlock is dropped between clusters to let faults proceed. */
+static void
+kswapd (void *aux UNUSED) {
+	for (;;) {
+		sema_down(&kswapd_sema);
+		for (;;) {
+			lock_acquire(&vlock);
+			size_t before = free_cnt;
+			if (free_cnt < vm_free_high && free_cnt < frame_cnt)
+				vm_evict_frames ();
+			if (free_cnt == before) {
+				kswapd_woken = false;
+				lock_release(&vlock);
+				break;
+			}
 			lock_release(&vlock);
-			return victim;
 		}
 	}
-	lock_release(&vlock);
-	return victim;
 }
 
-/* Evict one page and return the corresponding frame.
+/* Takes a frame from free_frames into the frame table, or returns NULL
+ * if there is none.
+ * Must be called with vlock held. */
+static struct frame *
+vm_take_free_frame (void) {
+	if (list_empty(&free_frames))
+		return NULL;
+	struct frame *frame = list_entry(list_pop_front(&free_frames), struct frame, ft_elem);
+	free_cnt--;
+	vm_frame_table_insert(frame);
+	if (free_cnt < vm_free_low)
+		kswapd_wake ();
+	return frame;
+}
+
+/* Evict pages and return a freed frame.  Only taken when kswapd has
+ * not kept up.
  * Return NULL on error.*/
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
-	if (victim->page != NULL){
-		swap_out(victim->page);
+	lock_acquire(&vlock);
+	/* Another thread may have refilled free_frames meanwhile. */
+	if (list_empty(&free_frames))
+		vm_evict_frames ();
+	struct frame *frame = vm_take_free_frame ();
+	lock_release(&vlock);
+	return frame;
+}
+
+/* Returns a frame that no page maps without evicting anything: one
+ * left over from a swap cluster or a new page from the user pool.
+ * Returns NULL if memory is full.  The contents are undefined. */
+struct frame *
+vm_get_free_frame (void) {
+	return get_free_frame (PAL_USER);
+}
+
+/* Like vm_get_free_frame, but the frame is zero-filled if FLAGS
+ * includes PAL_ZERO.  A new page then comes from the user pool's
+ * stash of pages zeroed by the idle thread, if possible. */
+static struct frame *
+get_free_frame (enum palloc_flags flags) {
+	lock_acquire(&vlock);
+	struct frame *frame = vm_take_free_frame ();
+	lock_release(&vlock);
+	if (frame != NULL) {
+		if (flags & PAL_ZERO)
+			clear_page(frame->kva);
+		return frame;
 	}
-	return victim;
+
+	void *kva = palloc_get_page(flags);
+	if (kva == NULL) {
+		lock_acquire(&vlock);
+		kswapd_wake ();
+		lock_release(&vlock);
+		return NULL;
+	}
+	frame = kmem_cache_alloc(&frame_cache);
+	if (frame == NULL) {
+		palloc_free_page(kva);
+		return NULL;
+	}
+	frame->kva = kva;
+	frame->page = NULL;
+	frame->ref_cnt = 0;
+	frame->pin_cnt = 0;
+	list_init(&frame->pages);
+	lock_acquire(&vlock);
+	vm_frame_table_insert(frame);
+	lock_release(&vlock);
+	return frame;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
@@ -157,26 +406,115 @@ vm_evict_frame (void) {
  * space.*/
 static struct frame *
 vm_get_frame (void) {
-	struct frame *frame = malloc(sizeof(struct frame));
-	// if (frame == NULL || frame -> kva == NULL) {
-	// 	PANIC("todo");
-	// 	return NULL;
-	// }
-	ASSERT (frame != NULL);
+	struct frame *frame = NULL;
 	/* TODO: Fill this function. */
-	frame->kva = palloc_get_page(PAL_USER|PAL_ZERO);
-	if(frame->kva == NULL){
+	frame = get_free_frame(PAL_USER | PAL_ZERO);
+	if (frame == NULL) {
 		frame = vm_evict_frame();
-	}else{
-	list_push_back (&framelist, &frame->ft_elem);
+		if (frame == NULL)
+			PANIC("vm_get_frame: no frame to evict");
+		clear_page(frame->kva);
 	}
-	frame->page = NULL;
-	ASSERT (frame != NULL);
 	ASSERT (frame->page == NULL);
 
 	return frame;
 }
 
+/* Returns FRAME, which no page maps, to the user pool.
+ * Must be called with vlock held. */
+static void
+vm_free_frame (struct frame *frame) {
+	ASSERT (frame->ref_cnt == 0);
+	vm_frame_table_remove(frame);
+	palloc_free_page(frame->kva);
+	kmem_cache_free(&frame_cache, frame);
+}
+
+/* Returns FRAME, obtained from vm_get_free_frame and never linked, to
+ * the user pool. */
+void
+vm_put_frame (struct frame *frame) {
+	lock_acquire(&vlock);
+	vm_free_frame(frame);
+	lock_release(&vlock);
+}
+
+/* Makes PAGE, whose contents are already in FRAME, resident and maps
+ * it in its page table.  Used to install pages read ahead from swap.
+ * Returns false, leaving FRAME unlinked, if the mapping fails. */
+bool
+vm_frame_install (struct frame *frame, struct page *page) {
+	bool success;
+	lock_acquire(&vlock);
+	vm_frame_link(frame, page);
+	success = pml4_set_page(page->pml4, page->va, frame->kva, page->writable);
+	if (!success)
+		vm_frame_unlink(frame, page);
+	lock_release(&vlock);
+	return success;
+}
+
+/* Adds PAGE to the pages sharing FRAME.
+ * Must be called with vlock held. */
+void
+vm_frame_link (struct frame *frame, struct page *page) {
+	list_push_back(&frame->pages, &page->frame_elem);
+	frame->ref_cnt++;
+	if (frame->page == NULL)
+		frame->page = page;
+	page->frame = frame;
+}
+
+/* Drops PAGE from the pages sharing FRAME and returns true if PAGE
+ * was the last one.
+ * Must be called with vlock held. */
+static bool
+vm_frame_unlink (struct frame *frame, struct page *page) {
+	list_remove(&page->frame_elem);
+	frame->ref_cnt--;
+	if (frame->page == page)
+		frame->page = list_empty(&frame->pages) ? NULL
+			: list_entry(list_front(&frame->pages), struct page, frame_elem);
+	page->frame = NULL;
+	return frame->ref_cnt == 0;
+}
+
+/* Unmaps PAGE from its frame and frees the frame when no other page
+ * shares it anymore. */
+void
+vm_frame_release (struct page *page) {
+	lock_acquire(&vlock);
+	struct frame *frame = page->frame;
+	if (frame != NULL) {
+		if (page->pml4 != NULL)
+			pml4_clear_page(page->pml4, page->va);
+		if (vm_frame_unlink(frame, page))
+			vm_free_frame(frame);
+	}
+	lock_release(&vlock);
+}
+
+/* Pins the frame of PAGE so that it is not evicted, and returns it.
+ * Returns NULL if PAGE is not resident. */
+struct frame *
+vm_frame_pin (struct page *page) {
+	lock_acquire(&vlock);
+	struct frame *frame = page->frame;
+	if (frame != NULL)
+		frame->pin_cnt++;
+	lock_release(&vlock);
+	return frame;
+}
+
+/* Undoes one vm_frame_pin of FRAME. */
+void
+vm_frame_unpin (struct frame *frame) {
+	lock_acquire(&vlock);
+	ASSERT (frame->pin_cnt > 0);
+	frame->pin_cnt--;
+	lock_release(&vlock);
+}
+
 /* Growing the stack. */
 static void
 vm_stack_growth (void *addr UNUSED) {
@@ -194,6 +532,26 @@ vm_stack_growth (void *addr UNUSED) {
 /* Handle the fault on write_protected page */
 static bool
 vm_handle_wp (struct page *page UNUSED) {
+	/* Get a private frame first: vm_get_frame may evict under vlock. */
+	struct frame *copy = vm_get_frame();
+
+	lock_acquire(&vlock);
+	struct frame *frame = page->frame;
+	if (frame == NULL) {
+		/* Evicted meanwhile.  The retried access faults it back in. */
+		vm_free_frame(copy);
+	} else if (frame->ref_cnt == 1) {
+		/* Others already broke the sharing, so just take it back. */
+		vm_free_frame(copy);
+		pml4_set_page(page->pml4, page->va, frame->kva, true);
+	} else {
+		copy_page(copy->kva, frame->kva);
+		vm_frame_unlink(frame, page);
+		vm_frame_link(copy, page);
+		pml4_set_page(page->pml4, page->va, copy->kva, true);
+	}
+	lock_release(&vlock);
+	return true;
 }
 
 /* Return true on success */
@@ -230,6 +588,12 @@ vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
             return false;
         return vm_do_claim_page(page);
     }
+	/* Write to a present, read-only page: copy-on-write after fork. */
+	if (write) {
+		page = spt_find_page(spt, addr);
+		if (page != NULL && page->writable && VM_TYPE(page->operations->type) == VM_ANON)
+			return vm_handle_wp(page);
+	}
     return false;
 }
 
@@ -238,7 +602,7 @@ vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
 void
 vm_dealloc_page (struct page *page) {
 	destroy (page);
-	free (page);
+	kmem_cache_free (&vm_page_cache, page);
 }
 
 /* Claim the page that allocate on VA. */
@@ -254,22 +618,148 @@ vm_claim_page (void *va UNUSED) {
 	return vm_do_claim_page (page);
 }
 
-/* Claim the PAGE and set up the mmu. */
+/* Returns true if PAGE is a writable anonymous page of PML4 that has
+ * never been touched and is all zeros on its first fault: a page with
+ * no initializer, or a bss page that lazy_load_segment, the only
+ * initializer of anonymous pages, reads nothing from the file for. */
+static bool
+vm_page_is_fresh_anon (struct page *page, uint64_t *pml4) {
+	if (page == NULL || page->frame != NULL || page->pml4 != pml4
+			|| !page->writable
+			|| VM_TYPE (page->operations->type) != VM_UNINIT
+			|| VM_TYPE (page->uninit.type) != VM_ANON)
+		return false;
+	return page->uninit.init == NULL
+		|| ((struct load_arg *) page->uninit.aux)->read_b == 0;
+}
+
+/* Claims all of the 2 MB-aligned region PAGE lies in at once, backed
+ * by a block of contiguous user pool frames mapped with one PDE, if
+ * every page of the region is a fresh anonymous page.  Each page
+ * still gets a frame of its own, so evicting or unmapping one of
+ * them just splits the mapping.  Returns false, changing nothing, if
+ * the region does not qualify or no block is free. */
 static bool
+vm_claim_huge (struct page *page) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint64_t *pml4 = page->pml4;
+	uint8_t *base = (uint8_t *) ((uint64_t) page->va & ~(HPGSIZE - 1));
+	const size_t cnt = HPGSIZE / PGSIZE;
+
+	if (pml4 == NULL || pml4 != thread_current ()->pml4)
+		return false;
+	/* The ends first: they are what a segment or the stack only
+	 * partly covers. */
+	if (!vm_page_is_fresh_anon (spt_find_page (spt, base), pml4)
+			|| !vm_page_is_fresh_anon (spt_find_page (spt, base + HPGSIZE - PGSIZE), pml4))
+		return false;
+	for (size_t i = 1; i < cnt - 1; i++)
+		if (!vm_page_is_fresh_anon (spt_find_page (spt, base + i * PGSIZE), pml4))
+			return false;
+
+	/* The buddy allocator aligns a block of 512 pages physically on
+	 * 2 MB. */
+	uint8_t *kva = palloc_get_multiple (PAL_USER | PAL_ZERO, cnt);
+	if (kva == NULL)
+		return false;
+	ASSERT (vtop (kva) % HPGSIZE == 0);
+
+	struct list frames;
+	list_init (&frames);
+	for (size_t i = 0; i < cnt; i++) {
+		struct frame *frame = kmem_cache_alloc (&frame_cache);
+		if (frame == NULL) {
+			while (!list_empty (&frames))
+				kmem_cache_free (&frame_cache, list_entry (list_pop_front (&frames),
+							struct frame, ft_elem));
+			palloc_free_multiple (kva, cnt);
+			return false;
+		}
+		frame->kva = kva + i * PGSIZE;
+		frame->page = NULL;
+		frame->ref_cnt = 0;
+		frame->pin_cnt = 0;
+		list_init (&frame->pages);
+		list_push_back (&frames, &frame->ft_elem);
+	}
+
+	/* Fresh pages only turn anonymous and stay zero.  The evictor
+	 * cannot see the frames until they are in the frame table, and
+	 * lazy_load_segment goes through the page cache, so this is done
+	 * before taking vlock. */
+	struct list_elem *e = list_begin (&frames);
+	for (size_t i = 0; i < cnt; i++, e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, ft_elem);
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+		p->frame = frame;
+		bool ok UNUSED = swap_in (p, frame->kva);
+		ASSERT (ok);
+	}
+
+	/* Map before the evictor can take any of the frames. */
+	lock_acquire (&vlock);
+	for (size_t i = 0; i < cnt; i++) {
+		struct frame *frame = list_entry (list_pop_front (&frames),
+				struct frame, ft_elem);
+		vm_frame_table_insert (frame);
+		vm_frame_link (frame, spt_find_page (spt, base + i * PGSIZE));
+	}
+	bool success = pml4_set_huge_page (pml4, base, kva, true);
+	if (!success) {
+		/* Part of the region already has a page table, or there is no
+		 * page table to set aside for splitting: map 4 kB pages. */
+		success = true;
+		for (size_t i = 0; i < cnt; i++)
+			success &= pml4_set_page (pml4, base + i * PGSIZE, kva + i * PGSIZE, true);
+	}
+	lock_release (&vlock);
+	return success;
+}
+
+/* Claim the PAGE and set up the mmu.
+ * File pages share the frame of the page cache instead of getting
+ * their own, and fresh anonymous pages may get a 2 MB page (see
+ * vm_claim_huge). */
+bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
-	
 	if (!page || page->frame)
 		return false;
-	/* Set links */
-	frame->page = page;
+
+	if (page_get_type (page) == VM_FILE) {
+		if (VM_TYPE (page->operations->type) == VM_UNINIT
+				&& !swap_in (page, NULL))
+			return false;
+		return page_cache_map (page);
+	}
+	if (vm_page_is_fresh_anon (page, page->pml4) && vm_claim_huge (page))
+		return true;
+	return vm_claim_frame (page, vm_get_frame ());
+}
+
+/* Fills FRAME, a frame from vm_get_free_frame or vm_get_frame, with
+ * the contents of PAGE, makes PAGE use it and maps it unless PAGE is
+ * a kernel page that no page table maps.  FRAME is freed on failure. */
+bool
+vm_claim_frame (struct page *page, struct frame *frame) {
+	/* Fill the frame before the evictor can see it through frame->page. */
 	page->frame = frame;
+	if (!swap_in (page, frame->kva)) {
+		page->frame = NULL;
+		lock_acquire(&vlock);
+		vm_free_frame(frame);
+		lock_release(&vlock);
+		return false;
+	}
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	/* Set links */
+	lock_acquire(&vlock);
+	vm_frame_link(frame, page);
+	lock_release(&vlock);
 
-	pml4_set_page (thread_current() -> pml4, page -> va, frame->kva, page -> writable);
-	
-	return swap_in (page, frame->kva);
+	if (page->pml4 == NULL)
+		return true;
+	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	return pml4_set_page (page->pml4, page -> va, frame->kva, page -> writable);
 }
 
 /* Initialize new supplemental page table */
@@ -278,7 +768,11 @@ supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
 	hash_init(&spt->sup_table,hash_page,hash_addr_comp,NULL);
 }
 
-/* Copy supplemental page table from src to dst */
+/* Copy supplemental page table from src to dst.
+ * Resident pages are not copied: the child maps the parent's frame and
+ * anonymous pages of both sides become read-only until one of them
+ * writes (see vm_handle_wp).  Swapped out anonymous pages share the
+ * swap slot. */
 bool
 supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
 		struct supplemental_page_table *src UNUSED) {
@@ -286,42 +780,43 @@ supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
 		hash_first (&i, &src->sup_table);
 		while (hash_next (&i)) {
 			struct page *fsp = hash_entry (hash_cur(&i), struct page, he);
-			enum vm_type tp = fsp->operations->type;
+			enum vm_type tp = VM_TYPE(fsp->operations->type);
 			if(tp == VM_UNINIT){
 				struct uninit_page *uninit = &fsp->uninit;
 				struct load_arg *unin = uninit->aux;
 				
-				vm_alloc_page_with_initializer(uninit->type,fsp->va,fsp->writable,uninit->init,unin);
-				continue;
-				}
-			else if (tp == VM_FILE)
-			{
-				struct load_arg *nx = malloc(sizeof(struct load_arg));
-				nx->file = fsp->file.file;
-				nx->offset = fsp->file.ofs;
-				nx->read_b = fsp->file.read_b;
-				nx->zero_b = fsp->file.zero_b;
-				if (!vm_alloc_page_with_initializer(tp, fsp->va, fsp->writable, NULL, nx))
-                	return false;
-            	struct page *file_page = spt_find_page(dst, fsp->va);
-				file_backed_initializer(file_page,tp,NULL);
-				// if(!vm_do_claim_page(file_page))
-				// 	return false;
-				file_page->frame = fsp->frame;
-            	pml4_set_page(thread_current()->pml4, file_page->va, fsp->frame->kva, fsp->writable);
+				if (!vm_alloc_page_with_initializer(uninit->type,fsp->va,fsp->writable,uninit->init,unin))
+					return false;
 				continue;
 			}
-			
-		if (!vm_alloc_page(tp, fsp->va, fsp->writable)) {
-			return false;
-		}
-		if (!vm_claim_page(fsp->va)) {
-			return false;
-		}
 
-		struct page *dst_page = spt_find_page(dst, fsp->va);
-		memcpy(dst_page->frame->kva, fsp->frame->kva, PGSIZE);
-			
+			struct page *dst_page = kmem_cache_alloc(&vm_page_cache);
+			if (dst_page == NULL)
+				return false;
+			memcpy(dst_page, fsp, sizeof(struct page));
+			dst_page->pml4 = thread_current()->pml4;
+			dst_page->frame = NULL;
+			if (!spt_insert_page(dst, dst_page)) {
+				kmem_cache_free(&vm_page_cache, dst_page);
+				return false;
+			}
+
+			lock_acquire(&vlock);
+			struct frame *frame = fsp->frame;
+			if (frame != NULL) {
+				/* File pages stay shared and writable like before. */
+				bool rw = tp == VM_FILE && fsp->writable;
+				if (!rw)
+					pml4_clear_writable(fsp->pml4, fsp->va);
+				vm_frame_link(frame, dst_page);
+				if (!pml4_set_page(dst_page->pml4, dst_page->va, frame->kva, rw)) {
+					vm_frame_unlink(frame, dst_page);
+					lock_release(&vlock);
+					return false;
+				}
+			} else if (tp == VM_ANON)
+				anon_swap_dup(dst_page);
+			lock_release(&vlock);
 		}
 		return true;
 }
@@ -345,7 +840,7 @@ bool hash_addr_comp(const struct hash_elem *a, const struct hash_elem *b, void *
 void del_hash_page(struct hash_elem *e, void *aux){
 	struct page *dp = hash_entry(e,struct page,he);
 	destroy (dp);
-	free (dp);
+	kmem_cache_free (&vm_page_cache, dp);
 }
 bool page_delete (struct hash *h, struct page *p) {
   return hash_delete (&h, &p->he);